@@ -1,9 +1,10 @@
 find_package(ProtoBuf REQUIRED)
+find_package(ZLIB REQUIRED)
 
 set(DEPENDENT_PACKAGES assert_log)
 
-set(DEPENDENT_INCLUDES ${PROTOBUF_INCLUDE_DIR})
+set(DEPENDENT_INCLUDES ${PROTOBUF_INCLUDE_DIR} ${ZLIB_INCLUDE_DIRS})
 
-set(DEPENDENT_LIBRARIES ${PROTOBUF_LIBRARY})
+set(DEPENDENT_LIBRARIES ${PROTOBUF_LIBRARY} ${ZLIB_LIBRARIES})
 
 set(CREATED_PACKAGES segment_util)
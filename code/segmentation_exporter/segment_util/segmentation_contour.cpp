@@ -0,0 +1,289 @@
+/*
+ *  segmentation_contour.cpp
+ *  segment_util
+ *
+ */
+
+#include "segmentation_contour.h"
+#include "assert_log.h"
+#include "segmentation_util.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+  #undef min
+  #undef max
+#endif
+
+namespace Segment {
+
+  typedef SegmentationDesc::Region SegRegion;
+  typedef SegmentationDesc::Region::Scanline Scanline;
+  typedef SegmentationDesc::Region::Scanline::Interval ScanlineInterval;
+
+  namespace {
+    // Pixel run [left, right] (inclusive) in row y.
+    struct Run {
+      Run(int y_, int left_, int right_) : y(y_), left(left_), right(right_) {}
+
+      bool operator<(const Run& rhs) const {
+        return y < rhs.y || (y == rhs.y && left < rhs.left);
+      }
+
+      int y;
+      int left;
+      int right;
+    };
+
+    // Directed boundary edge between two pixel corners. Direction is
+    // either horizontal or vertical.
+    struct Edge {
+      Edge(int x0, int y0, int x1, int y1) : start(x0, y0), end(x1, y1) {}
+
+      ContourPoint start;
+      ContourPoint end;
+    };
+
+    int64_t PointKey(const ContourPoint& p) {
+      return ((int64_t)p.y << 32) | (uint32_t)p.x;
+    }
+
+    int Sign(int v) {
+      return (v > 0) - (v < 0);
+    }
+
+    // Appends half-open segments [a, b) of runs in row that are not covered by
+    // runs in other_row to segments. Runs are merged and sorted.
+    void SubtractRuns(const Run* row, int row_sz,
+                      const Run* other_row, int other_sz,
+                      vector<std::pair<int, int> >* segments) {
+      int k = 0;
+      for (int i = 0; i < row_sz; ++i) {
+        int a = row[i].left;
+        const int b = row[i].right + 1;
+
+        // Skip runs in other_row that end before a.
+        while (k < other_sz && other_row[k].right + 1 <= a)
+          ++k;
+
+        int j = k;
+        while (a < b && j < other_sz && other_row[j].left < b) {
+          if (other_row[j].left > a)
+            segments->push_back(std::make_pair(a, other_row[j].left));
+          a = std::max(a, other_row[j].right + 1);
+          ++j;
+        }
+
+        if (a < b)
+          segments->push_back(std::make_pair(a, b));
+      }
+    }
+
+    // Traces boundaries of the area given by merged runs sorted by (y, left).
+    void TraceRuns(int region_id, const vector<Run>& runs, vector<RegionContour>* contours) {
+      // Row start offsets into runs.
+      const int min_y = runs.front().y;
+      const int max_y = runs.back().y;
+      vector<int> row_start(max_y - min_y + 2, 0);
+      for (vector<Run>::const_iterator r = runs.begin(); r != runs.end(); ++r)
+        ++row_start[r->y - min_y + 1];
+      for (int i = 1; i < (int)row_start.size(); ++i)
+        row_start[i] += row_start[i - 1];
+
+      vector<Edge> edges;
+      vector<std::pair<int, int> > segments;
+      for (int y = min_y; y <= max_y; ++y) {
+        const Run* row = runs.empty() ? 0 : &runs[0] + row_start[y - min_y];
+        const int row_sz = row_start[y - min_y + 1] - row_start[y - min_y];
+        if (row_sz == 0)
+          continue;
+
+        const Run* prev_row = 0;
+        int prev_sz = 0;
+        if (y > min_y) {
+          prev_row = &runs[0] + row_start[y - 1 - min_y];
+          prev_sz = row_start[y - min_y] - row_start[y - 1 - min_y];
+        }
+
+        const Run* next_row = 0;
+        int next_sz = 0;
+        if (y < max_y) {
+          next_row = &runs[0] + row_start[y + 1 - min_y];
+          next_sz = row_start[y + 2 - min_y] - row_start[y + 1 - min_y];
+        }
+
+        // Top edges run left to right.
+        segments.clear();
+        SubtractRuns(row, row_sz, prev_row, prev_sz, &segments);
+        for (int i = 0; i < (int)segments.size(); ++i)
+          edges.push_back(Edge(segments[i].first, y, segments[i].second, y));
+
+        // Bottom edges run right to left.
+        segments.clear();
+        SubtractRuns(row, row_sz, next_row, next_sz, &segments);
+        for (int i = 0; i < (int)segments.size(); ++i)
+          edges.push_back(Edge(segments[i].second, y + 1, segments[i].first, y + 1));
+
+        // Left edges run up, right edges run down.
+        for (int i = 0; i < row_sz; ++i) {
+          edges.push_back(Edge(row[i].left, y + 1, row[i].left, y));
+          edges.push_back(Edge(row[i].right + 1, y, row[i].right + 1, y + 1));
+        }
+      }
+
+      // Index edges by start point. Each corner has at most two outgoing edges.
+      vector<std::pair<int64_t, int> > by_start(edges.size());
+      for (int i = 0; i < (int)edges.size(); ++i)
+        by_start[i] = std::make_pair(PointKey(edges[i].start), i);
+      std::sort(by_start.begin(), by_start.end());
+
+      vector<bool> used(edges.size(), false);
+      for (int e = 0; e < (int)edges.size(); ++e) {
+        if (used[e])
+          continue;
+
+        RegionContour contour;
+        contour.region_id = region_id;
+
+        int cur = e;
+        int dx = 0;
+        int dy = 0;
+        while (!used[cur]) {
+          used[cur] = true;
+          const Edge& edge = edges[cur];
+          const int ndx = Sign(edge.end.x - edge.start.x);
+          const int ndy = Sign(edge.end.y - edge.start.y);
+
+          // Only emit corners.
+          if (ndx != dx || ndy != dy)
+            contour.points.push_back(edge.start);
+          dx = ndx;
+          dy = ndy;
+
+          // Find successor, at pinch points prefer turning right
+          // (dx, dy) -> (-dy, dx), which separates diagonally touching parts.
+          const int64_t key = PointKey(edge.end);
+          vector<std::pair<int64_t, int> >::const_iterator pos =
+              std::lower_bound(by_start.begin(), by_start.end(), std::make_pair(key, -1));
+          int next = -1;
+          for (; pos != by_start.end() && pos->first == key; ++pos) {
+            const Edge& cand = edges[pos->second];
+            const int cdx = Sign(cand.end.x - cand.start.x);
+            const int cdy = Sign(cand.end.y - cand.start.y);
+            if (next < 0 || (cdx == -dy && cdy == dx))
+              next = pos->second;
+          }
+
+          ASSERT_LOG(next >= 0) << "Open boundary detected.";
+          if (next < 0)
+            break;
+          cur = next;
+        }
+
+        // The first point is not a corner if the contour closes straight.
+        if (contour.points.size() > 1) {
+          const Edge& first = edges[e];
+          if (Sign(first.end.x - first.start.x) == dx &&
+              Sign(first.end.y - first.start.y) == dy)
+            contour.points.erase(contour.points.begin());
+        }
+
+        contour.is_hole = ContourSignedArea2(contour) < 0;
+        contours->push_back(contour);
+      }
+    }
+  }  // namespace.
+
+  void ExtractContours(int level,
+                       const SegmentationDesc& seg,
+                       const SegmentationDesc* seg_hier,
+                       vector<RegionContour>* contours) {
+    seg_hier = ResolveHierarchy(seg, seg_hier, &level);
+
+    // Group regions by their id at the requested level.
+    vector<std::pair<int, int> > region_ids(seg.region_size());
+    for (int k = 0; k < seg.region_size(); ++k) {
+      const SegRegion& r = seg.region(k);
+      const int region_id = level == 0 ? r.id() : AncestorId(r, level, seg_hier);
+      region_ids[k] = std::make_pair(region_id, k);
+    }
+    std::sort(region_ids.begin(), region_ids.end());
+
+    vector<Run> runs;
+    vector<Run> merged_runs;
+    for (int k = 0; k < (int)region_ids.size(); ) {
+      const int region_id = region_ids[k].first;
+      runs.clear();
+      for (; k < (int)region_ids.size() && region_ids[k].first == region_id; ++k) {
+        const SegRegion& r = seg.region(region_ids[k].second);
+        int y = r.top_y();
+        for (int s = 0; s < r.scanline_size(); ++s, ++y) {
+          const Scanline& scanline = r.scanline(s);
+          for (int i = 0, sz = scanline.interval_size(); i < sz; ++i) {
+            const ScanlineInterval& inter = scanline.interval(i);
+            runs.push_back(Run(y, inter.left_x(), inter.right_x()));
+          }
+        }
+      }
+
+      if (runs.empty())
+        continue;
+
+      // Merge touching runs of different child regions.
+      std::sort(runs.begin(), runs.end());
+      merged_runs.clear();
+      merged_runs.push_back(runs[0]);
+      for (int i = 1; i < (int)runs.size(); ++i) {
+        Run& last = merged_runs.back();
+        if (runs[i].y == last.y && runs[i].left <= last.right + 1)
+          last.right = std::max(last.right, runs[i].right);
+        else
+          merged_runs.push_back(runs[i]);
+      }
+
+      TraceRuns(region_id, merged_runs, contours);
+    }
+  }
+
+  int64_t ContourSignedArea2(const RegionContour& contour) {
+    int64_t area = 0;
+    const vector<ContourPoint>& points = contour.points;
+    for (int i = 0, sz = points.size(); i < sz; ++i) {
+      const ContourPoint& p = points[i];
+      const ContourPoint& q = points[(i + 1) % sz];
+      area += (int64_t)p.x * q.y - (int64_t)q.x * p.y;
+    }
+    return area;
+  }
+
+  void SerializeContours(const vector<RegionContour>& contours, vector<uchar>* data) {
+    int sz = sizeof(int);
+    for (vector<RegionContour>::const_iterator c = contours.begin(); c != contours.end(); ++c)
+      sz += 2 * sizeof(int) + c->points.size() * 2 * sizeof(uint16_t);
+
+    data->resize(sz);
+    uchar* ptr = &(*data)[0];
+
+    const int num_contours = contours.size();
+    memcpy(ptr, &num_contours, sizeof(num_contours));
+    ptr += sizeof(num_contours);
+
+    for (vector<RegionContour>::const_iterator c = contours.begin(); c != contours.end(); ++c) {
+      const int header[2] = { c->region_id,
+                              c->is_hole ? -(int)c->points.size() : (int)c->points.size() };
+      memcpy(ptr, header, sizeof(header));
+      ptr += sizeof(header);
+
+      for (vector<ContourPoint>::const_iterator p = c->points.begin();
+           p != c->points.end();
+           ++p) {
+        ASSERT_LOG(p->x >= 0 && p->x <= 0xffff && p->y >= 0 && p->y <= 0xffff);
+        const uint16_t coords[2] = { (uint16_t)p->x, (uint16_t)p->y };
+        memcpy(ptr, coords, sizeof(coords));
+        ptr += sizeof(coords);
+      }
+    }
+  }
+
+}  // namespace Segment.
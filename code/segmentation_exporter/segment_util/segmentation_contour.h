@@ -0,0 +1,74 @@
+/*
+ *  segmentation_contour.h
+ *  segment_util
+ *
+ *  Vector boundary extraction from the scanline representation.
+ *
+ */
+
+// Extracts outer and hole contours of every region at a specific hierarchy
+// level directly from the scanline intervals of consecutive rows, without
+// rasterizing the frame.
+//
+// Contours run along pixel corners, i.e. point (x, y) is the top-left corner of
+// pixel (x, y), and only contain the corner points of the (rectilinear)
+// polygon. Outer contours are oriented clockwise in image coordinates (region
+// on the right hand side), holes counter-clockwise. Regions that only touch
+// diagonally are traced as separate contours (4-connectivity).
+
+#ifndef SEGMENTATION_CONTOUR_H__
+#define SEGMENTATION_CONTOUR_H__
+
+#include "segmentation.pb.h"
+
+#include <vector>
+#ifdef __linux
+  #include <stdint.h>
+#endif
+
+#ifdef _WIN32
+  typedef __int64 int64_t;
+#endif
+
+namespace Segment {
+  typedef unsigned char uchar;
+  using std::vector;
+
+  struct ContourPoint {
+    ContourPoint() : x(0), y(0) {}
+    ContourPoint(int x_, int y_) : x(x_), y(y_) {}
+
+    int x;
+    int y;
+  };
+
+  struct RegionContour {
+    RegionContour() : region_id(-1), is_hole(false) {}
+
+    int region_id;
+    bool is_hole;
+    vector<ContourPoint> points;
+  };
+
+  // Appends contours of all regions at hierarchy_level in desc to contours.
+  // Level and hierarchy handling follow segmentation_util.h.
+  void ExtractContours(int hierarchy_level,
+                       const SegmentationDesc& desc,
+                       const SegmentationDesc* seg_hier,
+                       vector<RegionContour>* contours);
+
+  // Returns twice the signed area of contour, positive for outer contours.
+  int64_t ContourSignedArea2(const RegionContour& contour);
+
+  // Serializes contours to a compact binary format. Format:
+  // Number of contours : sizeof(int32)
+  // For every contour
+  //    Region id : sizeof(int32)
+  //    Number of points, negative for holes : sizeof(int32)
+  //    For every point
+  //       x, y : 2 * sizeof(uint16)
+  void SerializeContours(const vector<RegionContour>& contours, vector<uchar>* data);
+
+}  // namespace Segment.
+
+#endif  // SEGMENTATION_CONTOUR_H__
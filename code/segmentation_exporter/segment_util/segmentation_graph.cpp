@@ -0,0 +1,383 @@
+/*
+ *  segmentation_graph.cpp
+ *  segment_util
+ *
+ */
+
+#include "segmentation_graph.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+
+#ifdef _WIN32
+  #undef min
+  #undef max
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+namespace Segment {
+
+  namespace {
+    // Adds the neighbors of region to the sorted adjacency list of its id.
+    // Returns false if the region or a neighbor id is not below max_id, the
+    // id bound of the frame or hierarchy level.
+    template <class RegionType>
+    bool AddNeighbors(const RegionType& region,
+                      unsigned int max_id,
+                      vector<vector<int> >* adjacency) {
+      // Ids are unsigned, bounded this way they are valid int indices.
+      max_id = std::min<unsigned int>(max_id, std::numeric_limits<int>::max());
+      if (region.id() >= max_id)
+        return false;
+
+      int max_region_id = region.id();
+      for (int k = 0; k < region.neighbor_id_size(); ++k) {
+        if (region.neighbor_id(k) >= max_id)
+          return false;
+        max_region_id = std::max<int>(max_region_id, region.neighbor_id(k));
+      }
+
+      if (max_region_id >= (int)adjacency->size())
+        adjacency->resize(max_region_id + 1);
+
+      const int id = region.id();
+
+      // Neighbor lists usually repeat in every frame a region is present in, so
+      // most ids are already contained.
+      vector<int>& neighbors = (*adjacency)[id];
+      for (int k = 0; k < region.neighbor_id_size(); ++k) {
+        const int neighbor_id = region.neighbor_id(k);
+        if (neighbor_id == id)
+          continue;
+        vector<int>::iterator pos = std::lower_bound(neighbors.begin(), neighbors.end(),
+                                                     neighbor_id);
+        if (pos == neighbors.end() || *pos != neighbor_id)
+          neighbors.insert(pos, neighbor_id);
+      }
+      return true;
+    }
+
+    // Adds missing reverse edges.
+    void MakeSymmetric(vector<vector<int> >* adjacency) {
+      for (int id = 0; id < (int)adjacency->size(); ++id) {
+        const vector<int>& neighbors = (*adjacency)[id];
+        for (vector<int>::const_iterator n = neighbors.begin(); n != neighbors.end(); ++n) {
+          vector<int>& reverse = (*adjacency)[*n];
+          vector<int>::iterator pos = std::lower_bound(reverse.begin(), reverse.end(), id);
+          if (pos == reverse.end() || *pos != id)
+            reverse.insert(pos, id);
+        }
+      }
+    }
+
+    const char kGraphMagic[4] = { 'S', 'G', 'R', 'G' };
+  }  // namespace.
+
+  RegionGraph::RegionGraph() : mapped_data_(0), mapped_size_(0) {
+  }
+
+  RegionGraph::~RegionGraph() {
+    Clear();
+  }
+
+  void RegionGraph::Clear() {
+    levels_.clear();
+    buffer_.clear();
+#ifndef _WIN32
+    if (mapped_data_) {
+      munmap(mapped_data_, mapped_size_);
+    }
+#endif
+    mapped_data_ = 0;
+    mapped_size_ = 0;
+  }
+
+  bool RegionGraph::Build(SegmentationReader* reader) {
+    Clear();
+    const int num_frames = reader->FrameNumber();
+    if (num_frames == 0)
+      return false;
+
+    vector<vector<vector<int> > > adjacency(1);
+    SegmentationReader::FrameBuffer frame_buffer;
+
+    for (int f = 0; f < num_frames; ++f) {
+      if (!reader->ReadFrame(f, &frame_buffer)) {
+        std::cerr << "RegionGraph::Build: Could not read frame " << f << "\n";
+        return false;
+      }
+
+      const SegmentationDesc& desc = frame_buffer.desc;
+
+      // Hierarchy is only saved in the first frame.
+      if (f == 0) {
+        adjacency.resize(desc.hierarchy_size() + 1);
+        for (int l = 0; l < desc.hierarchy_size(); ++l) {
+          const SegmentationDesc::Hierarchy& hierarchy = desc.hierarchy(l);
+          for (int k = 0; k < hierarchy.region_size(); ++k) {
+            if (!AddNeighbors(hierarchy.region(k), hierarchy.max_id(), &adjacency[l + 1])) {
+              std::cerr << "RegionGraph::Build: Invalid region id at level " << l + 1 << "\n";
+              return false;
+            }
+          }
+        }
+      }
+
+      for (int k = 0; k < desc.region_size(); ++k) {
+        if (!AddNeighbors(desc.region(k), desc.max_id(), &adjacency[0])) {
+          std::cerr << "RegionGraph::Build: Invalid region id in frame " << f << "\n";
+          return false;
+        }
+      }
+    }
+
+    // Serialize into buffer_, so that built and mapped graphs are queried the
+    // same way.
+    const int num_levels = adjacency.size();
+    size_t size = 2 + 2 * num_levels;
+    for (int l = 0; l < num_levels; ++l) {
+      MakeSymmetric(&adjacency[l]);
+      size += adjacency[l].size() + 1;
+      for (int id = 0; id < (int)adjacency[l].size(); ++id) {
+        size += adjacency[l][id].size();
+      }
+    }
+
+    buffer_.reserve(size);
+    buffer_.resize(1);
+    memcpy(&buffer_[0], kGraphMagic, sizeof(kGraphMagic));
+    buffer_.push_back(num_levels);
+    for (int l = 0; l < num_levels; ++l) {
+      int num_entries = 0;
+      for (int id = 0; id < (int)adjacency[l].size(); ++id) {
+        num_entries += adjacency[l][id].size();
+      }
+      buffer_.push_back(adjacency[l].size());
+      buffer_.push_back(num_entries);
+    }
+
+    for (int l = 0; l < num_levels; ++l) {
+      int offset = 0;
+      for (int id = 0; id < (int)adjacency[l].size(); ++id) {
+        buffer_.push_back(offset);
+        offset += adjacency[l][id].size();
+      }
+      buffer_.push_back(offset);
+
+      for (int id = 0; id < (int)adjacency[l].size(); ++id) {
+        buffer_.insert(buffer_.end(), adjacency[l][id].begin(), adjacency[l][id].end());
+      }
+      // Free memory early, adjacency is about as large as the graph.
+      vector<vector<int> >().swap(adjacency[l]);
+    }
+
+    return ParseData(&buffer_[0], buffer_.size());
+  }
+
+  bool RegionGraph::ParseData(const int* data, size_t size) {
+    levels_.clear();
+    if (size < 2 || memcmp(data, kGraphMagic, sizeof(kGraphMagic)) != 0)
+      return false;
+
+    const int num_levels = data[1];
+    if (num_levels < 0 || (size - 2) / 2 < (size_t)num_levels)
+      return false;
+
+    size_t pos = 2 + 2 * num_levels;
+    levels_.resize(num_levels);
+    for (int l = 0; l < num_levels; ++l) {
+      Level& level = levels_[l];
+      level.num_regions = data[2 + 2 * l];
+      level.num_entries = data[3 + 2 * l];
+      if (level.num_regions < 0 || level.num_entries < 0 ||
+          size - pos < (size_t)level.num_regions + 1 + level.num_entries) {
+        levels_.clear();
+        return false;
+      }
+
+      level.offsets = data + pos;
+      pos += level.num_regions + 1;
+      level.neighbors = data + pos;
+      pos += level.num_entries;
+
+      // Offsets have to stay within the neighbor ids, so that queries need no
+      // further checks.
+      bool valid_offsets = level.offsets[0] == 0 &&
+                           level.offsets[level.num_regions] == level.num_entries;
+      for (int id = 0; id < level.num_regions && valid_offsets; ++id) {
+        valid_offsets = level.offsets[id] <= level.offsets[id + 1];
+      }
+
+      if (!valid_offsets) {
+        levels_.clear();
+        return false;
+      }
+    }
+
+    if (pos != size) {
+      levels_.clear();
+      return false;
+    }
+    return true;
+  }
+
+  bool RegionGraph::WriteToFile(const string& filename) const {
+    const char* data = mapped_data_ ? reinterpret_cast<const char*>(mapped_data_)
+                                    : reinterpret_cast<const char*>(&buffer_[0]);
+    const size_t size = mapped_data_ ? mapped_size_ : buffer_.size() * sizeof(buffer_[0]);
+    if (size == 0) {
+      std::cerr << "RegionGraph::WriteToFile: Graph is empty.\n";
+      return false;
+    }
+
+    std::ofstream ofs(filename.c_str(),
+                      std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!ofs) {
+      std::cerr << "RegionGraph::WriteToFile: "
+                << "Could not open " << filename << " to write!\n";
+      return false;
+    }
+
+    ofs.write(data, size);
+    return ofs.good();
+  }
+
+  bool RegionGraph::ReadFromFile(const string& filename) {
+    Clear();
+
+#ifdef _WIN32
+    std::ifstream ifs(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!ifs) {
+      return false;
+    }
+
+    ifs.seekg(0, std::ios_base::end);
+    const size_t file_size = ifs.tellg();
+    ifs.seekg(0, std::ios_base::beg);
+    if (file_size % sizeof(int) == 0) {
+      buffer_.resize(file_size / sizeof(int));
+      if (file_size > 0)
+        ifs.read(reinterpret_cast<char*>(&buffer_[0]), file_size);
+    }
+
+    const bool success = ifs && !buffer_.empty() && ParseData(&buffer_[0], buffer_.size());
+#else
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0 &&
+        file_stat.st_size % sizeof(int) == 0) {
+      void* data = mmap(0, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (data != MAP_FAILED) {
+        mapped_data_ = data;
+        mapped_size_ = file_stat.st_size;
+      }
+    }
+    // The mapping stays valid after closing.
+    close(fd);
+
+    const bool success = mapped_data_ &&
+        ParseData(reinterpret_cast<const int*>(mapped_data_), mapped_size_ / sizeof(int));
+#endif
+
+    if (!success) {
+      std::cerr << "RegionGraph::ReadFromFile: "
+                << filename << " is not a region graph.\n";
+      Clear();
+      return false;
+    }
+    return true;
+  }
+
+  int RegionGraph::NumRegions(int level) const {
+    level = std::min(level, NumLevels() - 1);
+    return level < 0 ? 0 : levels_[level].num_regions;
+  }
+
+  int RegionGraph::NumEdges(int level) const {
+    level = std::min(level, NumLevels() - 1);
+    return level < 0 ? 0 : levels_[level].num_entries / 2;
+  }
+
+  NeighborRange RegionGraph::Neighbors(int level, int region_id) const {
+    level = std::min(level, NumLevels() - 1);
+    if (level < 0 || region_id < 0 || region_id >= levels_[level].num_regions)
+      return NeighborRange();
+
+    const Level& graph_level = levels_[level];
+    return NeighborRange(graph_level.neighbors + graph_level.offsets[region_id],
+                         graph_level.neighbors + graph_level.offsets[region_id + 1]);
+  }
+
+  bool RegionGraph::AreNeighbors(int level, int region_id, int other_id) const {
+    const NeighborRange neighbors = Neighbors(level, region_id);
+    return std::binary_search(neighbors.begin, neighbors.end, other_id);
+  }
+
+  void RegionGraph::KHopNeighbors(int level,
+                                  const vector<int>& seed_ids,
+                                  int k,
+                                  vector<int>* regions,
+                                  vector<int>* distances) const {
+    regions->clear();
+    if (distances)
+      distances->clear();
+
+    // Unknown seeds are skipped.
+    const int num_regions = NumRegions(level);
+    vector<int> frontier;
+    for (vector<int>::const_iterator id = seed_ids.begin(); id != seed_ids.end(); ++id) {
+      if (*id >= 0 && *id < num_regions)
+        frontier.push_back(*id);
+    }
+    std::sort(frontier.begin(), frontier.end());
+    frontier.erase(std::unique(frontier.begin(), frontier.end()), frontier.end());
+
+    // Breadth-first search, one hop at a time. Visited regions are kept as a
+    // sorted list instead of a per-region flag, so that a query does not touch
+    // memory proportional to the number of regions.
+    vector<int> visited(frontier);
+    vector<int> candidates;
+    vector<int> next;
+    vector<int> merged;
+    for (int distance = 0; !frontier.empty(); ++distance) {
+      regions->insert(regions->end(), frontier.begin(), frontier.end());
+      if (distances)
+        distances->resize(regions->size(), distance);
+
+      if (distance >= k)
+        break;
+
+      candidates.clear();
+      for (vector<int>::const_iterator id = frontier.begin(); id != frontier.end(); ++id) {
+        const NeighborRange neighbors = Neighbors(level, *id);
+        candidates.insert(candidates.end(), neighbors.begin, neighbors.end);
+      }
+      std::sort(candidates.begin(), candidates.end());
+      candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+      next.clear();
+      std::set_difference(candidates.begin(), candidates.end(),
+                          visited.begin(), visited.end(),
+                          std::back_inserter(next));
+
+      merged.clear();
+      std::merge(visited.begin(), visited.end(), next.begin(), next.end(),
+                 std::back_inserter(merged));
+      visited.swap(merged);
+      frontier.swap(next);
+    }
+  }
+
+}  // namespace Segment.
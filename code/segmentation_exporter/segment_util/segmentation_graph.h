@@ -0,0 +1,132 @@
+/*
+ *  segmentation_graph.h
+ *  segment_util
+ *
+ *  Region adjacency graph of every hierarchy level.
+ *
+ */
+
+// Collects the spatio-temporal region adjacency stored in the neighbor_id
+// fields of a segmentation into one compressed sparse row (CSR) graph per
+// level, so that neighborhood queries never need to parse or rasterize
+// frames. Level 0 is built from the over-segmentation regions of all frames,
+// higher levels from the compound regions of the hierarchy; levels and ids are
+// the same as in SegmentationStats and RegionFrameIndex. Edges are undirected:
+// if either region lists the other as neighbor, both are adjacent.
+//
+// The graph can be saved to disk and mapped back into memory, queries then
+// operate directly on the mapped file, so opening a graph costs no parsing
+// and pages are only read when touched. All values are stored in native byte
+// order. Format:
+// Magic "SGRG" : 4 bytes
+// Number of levels : sizeof(int32)
+// For every level
+//    Number of region ids : sizeof(int32)
+//    Number of adjacency entries (twice the number of edges) : sizeof(int32)
+// For every level
+//    Neighbor start offsets, one per region id + 1 : sizeof(int32) each
+//    Neighbor ids, ascending for each region : sizeof(int32) each
+
+#ifndef SEGMENTATION_GRAPH_H__
+#define SEGMENTATION_GRAPH_H__
+
+#include "segmentation.pb.h"
+#include "segmentation_io.h"
+
+#include <string>
+#include <vector>
+
+namespace Segment {
+  using std::string;
+  using std::vector;
+
+  // Neighbors of a region as a range within the graph.
+  struct NeighborRange {
+    NeighborRange() : begin(0), end(0) {}
+    NeighborRange(const int* begin_, const int* end_) : begin(begin_), end(end_) {}
+
+    int size() const { return end - begin; }
+    bool empty() const { return begin == end; }
+
+    const int* begin;
+    const int* end;
+  };
+
+  class RegionGraph {
+  public:
+    RegionGraph();
+    ~RegionGraph();
+
+    // Reads every frame of an opened reader once. Hierarchy is expected in the
+    // first frame. Returns false if a frame can not be read or contains ids
+    // outside of its max_id.
+    bool Build(SegmentationReader* reader);
+
+    bool WriteToFile(const string& filename) const;
+
+    // Maps filename into memory (reads it on Windows). Returns false if the
+    // file is not a valid graph.
+    bool ReadFromFile(const string& filename);
+
+    // Number of levels including the over-segmentation.
+    int NumLevels() const { return levels_.size(); }
+
+    // Region ids at level are in [0, NumRegions(level)).
+    int NumRegions(int level) const;
+
+    // Number of undirected edges at level.
+    int NumEdges(int level) const;
+
+    // Returns the neighbors of region_id at level in ascending order, valid as
+    // long as the graph. Level is thresholded to the levels present. Empty if
+    // region_id is unknown.
+    NeighborRange Neighbors(int level, int region_id) const;
+
+    int Degree(int level, int region_id) const { return Neighbors(level, region_id).size(); }
+
+    bool AreNeighbors(int level, int region_id, int other_id) const;
+
+    // Returns all regions at level within k hops of any of seed_ids, seeds
+    // included, ordered by hop distance and by id within the same distance.
+    // If distances is not null, it receives the hop distance of each region.
+    // Cost is proportional to the size of the neighborhood, not of the graph,
+    // and concurrent queries are safe.
+    void KHopNeighbors(int level,
+                       const vector<int>& seed_ids,
+                       int k,
+                       vector<int>* regions,
+                       vector<int>* distances = 0) const;
+
+  private:
+    struct Level {
+      Level() : num_regions(0), num_entries(0), offsets(0), neighbors(0) {}
+
+      int num_regions;
+      int num_entries;
+      // Neighbors of id are neighbors[offsets[id] .. offsets[id + 1]).
+      const int* offsets;
+      const int* neighbors;
+    };
+
+    // Sets up levels_ from the serialized graph at data, returns false if it
+    // is malformed.
+    bool ParseData(const int* data, size_t size);
+
+    void Clear();
+
+    // Not copyable, levels_ point into buffer_ or the mapped file.
+    RegionGraph(const RegionGraph&);
+    RegionGraph& operator=(const RegionGraph&);
+
+  private:
+    vector<Level> levels_;
+
+    // Serialized graph, either owned or mapped.
+    vector<int> buffer_;
+    void* mapped_data_;
+    size_t mapped_size_;
+  };
+
+}  // namespace Segment.
+
+#endif  // SEGMENTATION_GRAPH_H__
@@ -0,0 +1,298 @@
+/*
+ *  segmentation_index.cpp
+ *  segment_util
+ *
+ */
+
+#include "segmentation_index.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+  #undef min
+  #undef max
+#endif
+
+namespace Segment {
+
+  namespace {
+    // Adds frame to the runs of region_id, frames are added in ascending order.
+    void AddFrameToRuns(int region_id, int frame, vector<vector<FrameRun> >* runs) {
+      if (region_id >= (int)runs->size())
+        runs->resize(region_id + 1);
+
+      vector<FrameRun>& region_runs = (*runs)[region_id];
+      if (!region_runs.empty() && region_runs.back().last >= frame - 1) {
+        region_runs.back().last = frame;
+      } else {
+        region_runs.push_back(FrameRun(frame, frame));
+      }
+    }
+
+    template <class T>
+    void WriteValue(const T& value, std::ofstream* ofs) {
+      ofs->write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <class T>
+    void ReadValue(std::ifstream* ifs, T* value) {
+      ifs->read(reinterpret_cast<char*>(value), sizeof(*value));
+    }
+
+    // Returns true if count elements of element_size bytes fit into the rest of
+    // the file.
+    bool IsValidCount(std::ifstream* ifs, int64_t file_size, int count, int element_size) {
+      if (!*ifs || count < 0)
+        return false;
+      const int64_t remaining = file_size - (int64_t)ifs->tellg();
+      return (int64_t)count * element_size <= remaining;
+    }
+  }  // namespace.
+
+  bool RegionFrameIndex::Build(SegmentationReader* reader) {
+    const int num_frames = reader->FrameNumber();
+    if (num_frames == 0)
+      return false;
+
+    frame_offsets_.resize(num_frames);
+    frame_sizes_.resize(num_frames);
+
+    SegmentationDesc seg_hier;
+    vector<vector<vector<FrameRun> > > level_runs(1);
+    SegmentationReader::FrameBuffer frame_buffer;
+
+    for (int f = 0; f < num_frames; ++f) {
+      // A partial index would be reused by later runs, see IsIndexOf.
+      if (!reader->ReadFrame(f, &frame_buffer)) {
+        std::cerr << "RegionFrameIndex::Build: Could not read frame " << f << "\n";
+        Clear();
+        return false;
+      }
+
+      // For uncompressed files, frame_buffer.data holds the protobuffer.
+      frame_offsets_[f] = reader->FileOffsets()[f] + sizeof(int);
+      frame_sizes_[f] = reader->IsCompressed() ? 0 : frame_buffer.data.size();
+
+      const SegmentationDesc& desc = frame_buffer.desc;
+
+      // Hierarchy is only saved in the first frame.
+      if (f == 0) {
+        seg_hier.mutable_hierarchy()->CopyFrom(desc.hierarchy());
+        level_runs.resize(seg_hier.hierarchy_size() + 1);
+      }
+
+      for (int k = 0; k < desc.region_size(); ++k) {
+        const SegmentationDesc::Region& r = desc.region(k);
+        if ((int)r.id() < 0) {
+          std::cerr << "RegionFrameIndex::Build: Invalid region id in frame " << f << "\n";
+          Clear();
+          return false;
+        }
+        AddFrameToRuns(r.id(), f, &level_runs[0]);
+
+        if (seg_hier.hierarchy_size() == 0 || !r.has_parent_id())
+          continue;
+
+        // Traverse to all ancestors.
+        int parent_id = r.parent_id();
+        for (int l = 0; ; ++l) {
+          if (parent_id < 0 ||
+              (l + 1 < seg_hier.hierarchy_size() &&
+               parent_id >= seg_hier.hierarchy(l).region_size())) {
+            std::cerr << "RegionFrameIndex::Build: Region " << parent_id << " of level "
+                      << l + 1 << " is missing in the hierarchy.\n";
+            Clear();
+            return false;
+          }
+
+          AddFrameToRuns(parent_id, f, &level_runs[l + 1]);
+          if (l + 1 >= seg_hier.hierarchy_size())
+            break;
+          const SegmentationDesc::CompoundRegion& parent = seg_hier.hierarchy(l).region(parent_id);
+          if (!parent.has_parent_id())
+            break;
+          parent_id = parent.parent_id();
+        }
+      }
+    }
+
+    // Compress runs.
+    run_start_.resize(level_runs.size());
+    runs_.resize(level_runs.size());
+    for (int l = 0; l < (int)level_runs.size(); ++l) {
+      const vector<vector<FrameRun> >& region_runs = level_runs[l];
+      run_start_[l].resize(region_runs.size() + 1);
+      runs_[l].clear();
+      for (int id = 0; id < (int)region_runs.size(); ++id) {
+        run_start_[l][id] = runs_[l].size();
+        runs_[l].insert(runs_[l].end(), region_runs[id].begin(), region_runs[id].end());
+      }
+      run_start_[l].back() = runs_[l].size();
+    }
+
+    return true;
+  }
+
+  vector<FrameRun> RegionFrameIndex::RegionRuns(int level, int region_id) const {
+    level = std::min(level, NumLevels() - 1);
+    if (level < 0 || region_id < 0 || region_id + 1 >= (int)run_start_[level].size())
+      return vector<FrameRun>();
+
+    return vector<FrameRun>(runs_[level].begin() + run_start_[level][region_id],
+                            runs_[level].begin() + run_start_[level][region_id + 1]);
+  }
+
+  void RegionFrameIndex::FramesForRegions(int level,
+                                          const vector<int>& region_ids,
+                                          vector<int>* frames) const {
+    frames->clear();
+    for (vector<int>::const_iterator id = region_ids.begin(); id != region_ids.end(); ++id) {
+      const vector<FrameRun> runs = RegionRuns(level, *id);
+      for (vector<FrameRun>::const_iterator run = runs.begin(); run != runs.end(); ++run) {
+        for (int f = run->first; f <= run->last; ++f)
+          frames->push_back(f);
+      }
+    }
+
+    std::sort(frames->begin(), frames->end());
+    frames->erase(std::unique(frames->begin(), frames->end()), frames->end());
+  }
+
+  bool RegionFrameIndex::WriteToFile(const string& filename) const {
+    std::ofstream ofs(filename.c_str(),
+                      std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!ofs) {
+      std::cerr << "RegionFrameIndex::WriteToFile: "
+                << "Could not open " << filename << " to write!\n";
+      return false;
+    }
+
+    ofs.write("SGIX", 4);
+    WriteValue((int)frame_offsets_.size(), &ofs);
+    for (int f = 0; f < (int)frame_offsets_.size(); ++f) {
+      WriteValue(frame_offsets_[f], &ofs);
+      WriteValue(frame_sizes_[f], &ofs);
+    }
+
+    WriteValue(NumLevels(), &ofs);
+    for (int l = 0; l < NumLevels(); ++l) {
+      WriteValue((int)run_start_[l].size() - 1, &ofs);
+      ofs.write(reinterpret_cast<const char*>(&run_start_[l][0]),
+                run_start_[l].size() * sizeof(run_start_[l][0]));
+      WriteValue((int)runs_[l].size(), &ofs);
+      for (vector<FrameRun>::const_iterator run = runs_[l].begin(); run != runs_[l].end(); ++run) {
+        WriteValue(run->first, &ofs);
+        WriteValue(run->last, &ofs);
+      }
+    }
+
+    return ofs.good();
+  }
+
+  bool RegionFrameIndex::ReadFromFile(const string& filename) {
+    std::ifstream ifs(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!ifs) {
+      return false;
+    }
+
+    if (!ReadIndex(&ifs)) {
+      std::cerr << "RegionFrameIndex::ReadFromFile: "
+                << filename << " is not a valid region index.\n";
+      Clear();
+      return false;
+    }
+    return true;
+  }
+
+  void RegionFrameIndex::Clear() {
+    frame_offsets_.clear();
+    frame_sizes_.clear();
+    run_start_.clear();
+    runs_.clear();
+  }
+
+  bool RegionFrameIndex::ReadIndex(std::ifstream* ifs) {
+    ifs->seekg(0, std::ios_base::end);
+    const int64_t file_size = ifs->tellg();
+    ifs->seekg(0, std::ios_base::beg);
+
+    char magic[4];
+    ifs->read(magic, 4);
+    if (!*ifs || string(magic, 4) != "SGIX")
+      return false;
+
+    // Counts are checked against the remaining file size before allocating.
+    int num_frames = 0;
+    ReadValue(ifs, &num_frames);
+    if (!IsValidCount(ifs, file_size, num_frames, sizeof(int64_t) + sizeof(int)))
+      return false;
+
+    frame_offsets_.resize(num_frames);
+    frame_sizes_.resize(num_frames);
+    for (int f = 0; f < num_frames; ++f) {
+      ReadValue(ifs, &frame_offsets_[f]);
+      ReadValue(ifs, &frame_sizes_[f]);
+    }
+
+    int num_levels = 0;
+    ReadValue(ifs, &num_levels);
+    if (!IsValidCount(ifs, file_size, num_levels, 3 * sizeof(int)))
+      return false;
+
+    run_start_.resize(num_levels);
+    runs_.resize(num_levels);
+    for (int l = 0; l < num_levels; ++l) {
+      int num_ids = 0;
+      ReadValue(ifs, &num_ids);
+      if (!IsValidCount(ifs, file_size, num_ids, sizeof(int)))
+        return false;
+
+      run_start_[l].resize(num_ids + 1);
+      ifs->read(reinterpret_cast<char*>(&run_start_[l][0]),
+                run_start_[l].size() * sizeof(run_start_[l][0]));
+
+      int num_runs = 0;
+      ReadValue(ifs, &num_runs);
+      if (!IsValidCount(ifs, file_size, num_runs, 2 * sizeof(int)))
+        return false;
+
+      runs_[l].resize(num_runs);
+      for (int r = 0; r < num_runs; ++r) {
+        ReadValue(ifs, &runs_[l][r].first);
+        ReadValue(ifs, &runs_[l][r].last);
+      }
+      if (!*ifs)
+        return false;
+
+      // Run offsets have to be ascending and within runs_, runs within the
+      // frames of the file.
+      if (run_start_[l][0] != 0 || run_start_[l][num_ids] != num_runs)
+        return false;
+      for (int id = 0; id < num_ids; ++id) {
+        if (run_start_[l][id] > run_start_[l][id + 1])
+          return false;
+      }
+      for (int r = 0; r < num_runs; ++r) {
+        if (runs_[l][r].first < 0 || runs_[l][r].first > runs_[l][r].last ||
+            runs_[l][r].last >= num_frames)
+          return false;
+      }
+    }
+
+    return !ifs->fail();
+  }
+
+  bool RegionFrameIndex::IsIndexOf(const SegmentationReader& reader) const {
+    // Frame offsets change with any change of the file's frames.
+    if (reader.FrameNumber() != NumFrames())
+      return false;
+    for (int f = 0; f < NumFrames(); ++f) {
+      if (reader.FileOffsets()[f] + (int64_t)sizeof(int) != frame_offsets_[f])
+        return false;
+    }
+    return true;
+  }
+
+}  // namespace Segment.
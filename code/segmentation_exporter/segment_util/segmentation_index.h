@@ -0,0 +1,105 @@
+/*
+ *  segmentation_index.h
+ *  segment_util
+ *
+ *  Inverted index from regions to the frames they are present in.
+ *
+ */
+
+// Maps each region id at each hierarchy level to the runs of consecutive
+// frames it is present in, along with the byte range of every frame in the
+// segmentation file. Built in a single pass over the file, it allows to only
+// seek to and parse frames that contain a set of regions, e.g. to export the
+// mask of an object in time proportional to the object's lifetime.
+//
+// The index can be saved to disk. Format:
+// Magic "SGIX" : 4 bytes
+// Number of frames : sizeof(int32)
+// For every frame
+//    File offset of frame : sizeof(int64)
+//    Size of frame in bytes : sizeof(int32)
+// Number of levels : sizeof(int32)
+// For every level
+//    Number of region ids : sizeof(int32)
+//    Run start offsets, one per region id + 1 : sizeof(int32) each
+//    Number of runs : sizeof(int32)
+//    For every run
+//       First frame, last frame : 2 * sizeof(int32)
+
+#ifndef SEGMENTATION_INDEX_H__
+#define SEGMENTATION_INDEX_H__
+
+#include "segmentation.pb.h"
+#include "segmentation_io.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace Segment {
+  using std::string;
+  using std::vector;
+
+  // Inclusive run of consecutive frames.
+  struct FrameRun {
+    FrameRun() : first(0), last(0) {}
+    FrameRun(int first_, int last_) : first(first_), last(last_) {}
+
+    int first;
+    int last;
+  };
+
+  class RegionFrameIndex {
+  public:
+    RegionFrameIndex() {}
+
+    // Reads every frame of an opened reader once. Hierarchy is expected in the
+    // first frame. Returns false and leaves the index empty if a frame can not
+    // be read or references regions missing in the hierarchy.
+    bool Build(SegmentationReader* reader);
+
+    bool WriteToFile(const string& filename) const;
+
+    // Returns false if filename does not exist or is not a valid index.
+    bool ReadFromFile(const string& filename);
+
+    // Returns true if the index was built from the file opened by reader, i.e.
+    // the number of frames and their file offsets match. Indices of other or
+    // modified files must not be used with reader.
+    bool IsIndexOf(const SegmentationReader& reader) const;
+
+    // Number of levels including the over-segmentation.
+    int NumLevels() const { return run_start_.size(); }
+    int NumFrames() const { return frame_offsets_.size(); }
+
+    // Returns runs of frames in which region_id at level is present, in
+    // ascending order. Level is thresholded to the levels present.
+    // Empty if region_id is unknown.
+    vector<FrameRun> RegionRuns(int level, int region_id) const;
+
+    // Sorted union of all frames containing any of region_ids at level.
+    void FramesForRegions(int level, const vector<int>& region_ids, vector<int>* frames) const;
+
+    // Byte range of a frame's protobuffer within the segmentation file. Only
+    // meaningful for uncompressed files, see segmentation_io.h.
+    int64_t FrameOffset(int frame) const { return frame_offsets_[frame]; }
+    int FrameSize(int frame) const { return frame_sizes_[frame]; }
+
+  private:
+    bool ReadIndex(std::ifstream* ifs);
+    void Clear();
+
+  private:
+    // Per frame byte ranges.
+    vector<int64_t> frame_offsets_;
+    vector<int> frame_sizes_;
+
+    // Per level compressed rows: runs of region id are stored in
+    // runs_[level][run_start_[level][id] .. run_start_[level][id + 1]).
+    vector<vector<int> > run_start_;
+    vector<vector<FrameRun> > runs_;
+  };
+
+}  // namespace Segment.
+
+#endif  // SEGMENTATION_INDEX_H__
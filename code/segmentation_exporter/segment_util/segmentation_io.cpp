@@ -9,10 +9,319 @@
 
 #include "segmentation_io.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <map>
+
+#include <zlib.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace Segment {
   
+  namespace {
+    typedef google::protobuf::RepeatedField<google::protobuf::uint32> IdField;
+    typedef google::protobuf::RepeatedField<google::protobuf::int32> DeltaField;
+    
+    // Id sequences are delta coded modulo 2^32, which is lossless for any order.
+    void PackIds(const IdField& ids, DeltaField* deltas) {
+      deltas->Reserve(ids.size());
+      google::protobuf::uint32 prev = 0;
+      for (int i = 0; i < ids.size(); ++i) {
+        deltas->Add((google::protobuf::int32)(ids.Get(i) - prev));
+        prev = ids.Get(i);
+      }
+    }
+    
+    void UnpackIds(const DeltaField& deltas, IdField* ids) {
+      ids->Reserve(deltas.size());
+      google::protobuf::uint32 prev = 0;
+      for (int i = 0; i < deltas.size(); ++i) {
+        prev += (google::protobuf::uint32)deltas.Get(i);
+        ids->Add(prev);
+      }
+    }
+    
+    void PackRegion(const SegmentationDesc::Region& region,
+                    PackedSegmentationDesc::Region* packed_region) {
+      packed_region->set_id(region.id());
+      packed_region->set_size(region.size());
+      PackIds(region.neighbor_id(), packed_region->mutable_neighbor_id_delta());
+      packed_region->set_top_y(region.top_y());
+      if (region.has_parent_id()) {
+        packed_region->set_parent_id(region.parent_id());
+      }
+      
+      packed_region->mutable_scanline_size()->Reserve(region.scanline_size());
+      for (int s = 0; s < region.scanline_size(); ++s) {
+        const SegmentationDesc::Region::Scanline& scanline = region.scanline(s);
+        packed_region->add_scanline_size(scanline.interval_size());
+        google::protobuf::uint32 prev_right = 0;
+        for (int i = 0; i < scanline.interval_size(); ++i) {
+          const SegmentationDesc::Region::Scanline::Interval& interval = scanline.interval(i);
+          packed_region->add_interval_delta(
+              (google::protobuf::int32)(interval.left_x() - prev_right));
+          packed_region->add_interval_delta(
+              (google::protobuf::int32)(interval.right_x() - interval.left_x()));
+          prev_right = interval.right_x();
+        }
+      }
+    }
+    
+    bool UnpackRegion(const PackedSegmentationDesc::Region& packed_region,
+                      SegmentationDesc::Region* region) {
+      region->set_id(packed_region.id());
+      region->set_size(packed_region.size());
+      UnpackIds(packed_region.neighbor_id_delta(), region->mutable_neighbor_id());
+      region->set_top_y(packed_region.top_y());
+      if (packed_region.has_parent_id()) {
+        region->set_parent_id(packed_region.parent_id());
+      }
+      
+      region->mutable_scanline()->Reserve(packed_region.scanline_size_size());
+      int delta_idx = 0;
+      for (int s = 0; s < packed_region.scanline_size_size(); ++s) {
+        const int num_intervals = packed_region.scanline_size(s);
+        if (num_intervals < 0 ||
+            num_intervals > (packed_region.interval_delta_size() - delta_idx) / 2) {
+          return false;
+        }
+        
+        SegmentationDesc::Region::Scanline* scanline = region->add_scanline();
+        scanline->mutable_interval()->Reserve(num_intervals);
+        google::protobuf::uint32 prev_right = 0;
+        for (int i = 0; i < num_intervals; ++i, delta_idx += 2) {
+          SegmentationDesc::Region::Scanline::Interval* interval = scanline->add_interval();
+          const google::protobuf::uint32 left =
+              prev_right + (google::protobuf::uint32)packed_region.interval_delta(delta_idx);
+          prev_right = left + (google::protobuf::uint32)packed_region.interval_delta(delta_idx + 1);
+          interval->set_left_x(left);
+          interval->set_right_x(prev_right);
+        }
+      }
+      
+      return delta_idx == packed_region.interval_delta_size();
+    }
+    
+    // Returns true if region equals prev translated by (dx, dy).
+    bool IsShiftedRegion(const SegmentationDesc::Region& prev,
+                         const SegmentationDesc::Region& region,
+                         google::protobuf::uint32* dx,
+                         google::protobuf::uint32* dy) {
+      if (prev.id() != region.id() ||
+          prev.size() != region.size() ||
+          prev.has_parent_id() != region.has_parent_id() ||
+          prev.parent_id() != region.parent_id() ||
+          prev.neighbor_id_size() != region.neighbor_id_size() ||
+          prev.scanline_size() != region.scanline_size()) {
+        return false;
+      }
+      
+      for (int n = 0; n < region.neighbor_id_size(); ++n) {
+        if (prev.neighbor_id(n) != region.neighbor_id(n))
+          return false;
+      }
+      
+      *dy = region.top_y() - prev.top_y();
+      bool first_interval = true;
+      for (int s = 0; s < region.scanline_size(); ++s) {
+        const SegmentationDesc::Region::Scanline& prev_scanline = prev.scanline(s);
+        const SegmentationDesc::Region::Scanline& scanline = region.scanline(s);
+        if (prev_scanline.interval_size() != scanline.interval_size())
+          return false;
+        
+        for (int i = 0; i < scanline.interval_size(); ++i) {
+          const SegmentationDesc::Region::Scanline::Interval& prev_interval =
+              prev_scanline.interval(i);
+          const SegmentationDesc::Region::Scanline::Interval& interval = scanline.interval(i);
+          if (first_interval) {
+            *dx = interval.left_x() - prev_interval.left_x();
+            first_interval = false;
+          }
+          if (interval.left_x() - prev_interval.left_x() != *dx ||
+              interval.right_x() - prev_interval.right_x() != *dx) {
+            return false;
+          }
+        }
+      }
+      
+      if (first_interval) {
+        *dx = 0;
+      }
+      return true;
+    }
+    
+    // Regions of desc equal to a translated region of previous are stored as
+    // references, if previous is set.
+    void PackSegmentation(const SegmentationDesc& desc,
+                          const SegmentationDesc* previous,
+                          PackedSegmentationDesc* packed) {
+      packed->Clear();
+      packed->set_max_id(desc.max_id());
+      
+      if (previous == 0) {
+        for (int r = 0; r < desc.region_size(); ++r) {
+          PackRegion(desc.region(r), packed->add_region());
+        }
+      } else {
+        std::map<google::protobuf::uint32, int> previous_index;
+        for (int r = 0; r < previous->region_size(); ++r) {
+          previous_index.insert(std::make_pair(previous->region(r).id(), r));
+        }
+        
+        // Each region of previous is referenced at most once.
+        vector<bool> referenced(previous->region_size(), false);
+        int last_ref = -1;
+        for (int r = 0; r < desc.region_size(); ++r) {
+          const SegmentationDesc::Region& region = desc.region(r);
+          std::map<google::protobuf::uint32, int>::const_iterator prev =
+              previous_index.find(region.id());
+          google::protobuf::uint32 dx;
+          google::protobuf::uint32 dy;
+          if (prev != previous_index.end() &&
+              !referenced[prev->second] &&
+              IsShiftedRegion(previous->region(prev->second), region, &dx, &dy)) {
+            referenced[prev->second] = true;
+            packed->add_region_ref(prev->second - last_ref);
+            packed->add_region_shift((google::protobuf::int32)dx);
+            packed->add_region_shift((google::protobuf::int32)dy);
+            last_ref = prev->second;
+          } else {
+            packed->add_region_ref(0);
+            PackRegion(region, packed->add_region());
+          }
+        }
+      }
+      
+      for (int h = 0; h < desc.hierarchy_size(); ++h) {
+        const SegmentationDesc::Hierarchy& hierarchy = desc.hierarchy(h);
+        PackedSegmentationDesc::Hierarchy* packed_hierarchy = packed->add_hierarchy();
+        packed_hierarchy->set_level(hierarchy.level());
+        packed_hierarchy->set_max_id(hierarchy.max_id());
+        for (int r = 0; r < hierarchy.region_size(); ++r) {
+          const SegmentationDesc::CompoundRegion& region = hierarchy.region(r);
+          PackedSegmentationDesc::CompoundRegion* packed_region = packed_hierarchy->add_region();
+          packed_region->set_id(region.id());
+          packed_region->set_size(region.size());
+          PackIds(region.neighbor_id(), packed_region->mutable_neighbor_id_delta());
+          if (region.has_parent_id()) {
+            packed_region->set_parent_id(region.parent_id());
+          }
+          PackIds(region.child_id(), packed_region->mutable_child_id_delta());
+        }
+      }
+      
+      if (desc.has_frame_width()) {
+        packed->set_frame_width(desc.frame_width());
+      }
+      if (desc.has_frame_height()) {
+        packed->set_frame_height(desc.frame_height());
+      }
+    }
+    
+    // For delta frames, previous has to hold the previous frame. Referenced
+    // regions are moved from previous into desc, i.e. previous is modified.
+    bool UnpackSegmentation(const PackedSegmentationDesc& packed,
+                            SegmentationDesc* previous,
+                            SegmentationDesc* desc) {
+      desc->Clear();
+      desc->set_max_id(packed.max_id());
+      
+      if (previous == 0) {
+        desc->mutable_region()->Reserve(packed.region_size());
+        for (int r = 0; r < packed.region_size(); ++r) {
+          if (!UnpackRegion(packed.region(r), desc->add_region()))
+            return false;
+        }
+      } else {
+        if (packed.region_shift_size() != 2 * (packed.region_ref_size() - packed.region_size()))
+          return false;
+        
+        desc->mutable_region()->Reserve(packed.region_ref_size());
+        int region_idx = 0;
+        int shift_idx = 0;
+        int last_ref = -1;
+        for (int r = 0; r < packed.region_ref_size(); ++r) {
+          if (packed.region_ref(r) == 0) {
+            if (region_idx >= packed.region_size() ||
+                !UnpackRegion(packed.region(region_idx++), desc->add_region())) {
+              return false;
+            }
+            continue;
+          }
+          
+          const int ref = last_ref + packed.region_ref(r);
+          if (ref < 0 || ref >= previous->region_size() || shift_idx + 2 > packed.region_shift_size())
+            return false;
+          last_ref = ref;
+          
+          // Unchanged regions are moved instead of copied.
+          SegmentationDesc::Region* region = desc->add_region();
+          region->Swap(previous->mutable_region(ref));
+          if (!region->has_id())
+            return false;   // Referenced twice.
+          
+          const google::protobuf::uint32 dx = (google::protobuf::uint32)packed.region_shift(shift_idx++);
+          const google::protobuf::uint32 dy = (google::protobuf::uint32)packed.region_shift(shift_idx++);
+          if (dy != 0) {
+            region->set_top_y(region->top_y() + dy);
+          }
+          if (dx != 0) {
+            for (int s = 0; s < region->scanline_size(); ++s) {
+              SegmentationDesc::Region::Scanline* scanline = region->mutable_scanline(s);
+              for (int i = 0; i < scanline->interval_size(); ++i) {
+                SegmentationDesc::Region::Scanline::Interval* interval =
+                    scanline->mutable_interval(i);
+                interval->set_left_x(interval->left_x() + dx);
+                interval->set_right_x(interval->right_x() + dx);
+              }
+            }
+          }
+        }
+        
+        if (region_idx != packed.region_size())
+          return false;
+      }
+      
+      for (int h = 0; h < packed.hierarchy_size(); ++h) {
+        const PackedSegmentationDesc::Hierarchy& packed_hierarchy = packed.hierarchy(h);
+        SegmentationDesc::Hierarchy* hierarchy = desc->add_hierarchy();
+        hierarchy->set_level(packed_hierarchy.level());
+        hierarchy->set_max_id(packed_hierarchy.max_id());
+        hierarchy->mutable_region()->Reserve(packed_hierarchy.region_size());
+        for (int r = 0; r < packed_hierarchy.region_size(); ++r) {
+          const PackedSegmentationDesc::CompoundRegion& packed_region = packed_hierarchy.region(r);
+          SegmentationDesc::CompoundRegion* region = hierarchy->add_region();
+          region->set_id(packed_region.id());
+          region->set_size(packed_region.size());
+          UnpackIds(packed_region.neighbor_id_delta(), region->mutable_neighbor_id());
+          if (packed_region.has_parent_id()) {
+            region->set_parent_id(packed_region.parent_id());
+          }
+          UnpackIds(packed_region.child_id_delta(), region->mutable_child_id());
+        }
+      }
+      
+      if (packed.has_frame_width()) {
+        desc->set_frame_width(packed.frame_width());
+      }
+      if (packed.has_frame_height()) {
+        desc->set_frame_height(packed.frame_height());
+      }
+      return true;
+    }
+  }  // namespace.
+  
   bool SegmentationWriter::OpenAndPrepareFileHeader() {
     // Open file to write
     ofs_.open(filename_.c_str(), 
@@ -24,6 +333,17 @@ namespace Segment {
       return false;
     }
     
+    if (format_ == SEGMENTATION_FORMAT_COMPRESSED) {
+      const int version = UseDeltaFrames() ? kDeltaFileVersion : kCompressedFileVersion;
+      ofs_.write(reinterpret_cast<const char*>(&kCompressedFileMarker),
+                 sizeof(kCompressedFileMarker));
+      ofs_.write(reinterpret_cast<const char*>(&version), sizeof(version));
+      if (UseDeltaFrames()) {
+        ofs_.write(reinterpret_cast<const char*>(&keyframe_interval_), sizeof(keyframe_interval_));
+      }
+    }
+    header_pos_ = ofs_.tellp();
+    
     // Write dummy header. To be filled on post process.
     int num_frames = 0;
     int64_t header_offset = 0;
@@ -34,46 +354,115 @@ namespace Segment {
     return true;
   }
   
-  void SegmentationWriter::WriteOffsetsAndClose() {
+  bool SegmentationWriter::WriteOffsetsAndClose() {
     // Header information.
     int num_frames = file_offsets_.size();
     int64_t header_offset = ofs_.tellp();
     
     //  Write file offsets to end.
-    for (int i = 0; i < file_offsets_.size(); ++i) {
+    for (int i = 0; i < num_frames; ++i) {
       ofs_.write(reinterpret_cast<const char*>(&file_offsets_[i]), sizeof(file_offsets_[i]));
       ofs_.write(reinterpret_cast<const char*>(&time_stamps_[i]), sizeof(time_stamps_[i]));
     }
     
     // Write header.
-    ofs_.seekp(0);
+    ofs_.seekp(header_pos_);
     ofs_.write(reinterpret_cast<const char*>(&num_frames), sizeof(num_frames));
     ofs_.write(reinterpret_cast<const char*>(&header_offset), sizeof(header_offset));
     
-    ofs_.close();    
+    // Failures of previous writes are sticky in the stream state.
+    ofs_.close();
+    if (ofs_.fail()) {
+      std::cerr << "SegmentationWriter::WriteOffsetsAndClose: "
+      << "Could not write " << filename_ << "\n";
+      return false;
+    }
+    return true;
   }
   
-  void SegmentationWriter::FlushAndReopen(const string& filename) {
-    WriteOffsetsAndClose();
+  bool SegmentationWriter::FlushAndReopen(const string& filename) {
+    const bool success = WriteOffsetsAndClose();
     filename_ = filename;
     file_offsets_.clear();
     time_stamps_.clear();
-    OpenAndPrepareFileHeader();
+    previous_desc_.Clear();
+    ofs_.clear();
+    return OpenAndPrepareFileHeader() && success;
   }
   
-  void SegmentationWriter::WriteSegmentation(const uchar* data, int sz, int64_t pts) {
+  bool SegmentationWriter::WriteSegmentation(const uchar* data, int sz, int64_t pts) {
+    if (format_ == SEGMENTATION_FORMAT_COMPRESSED) {
+      SegmentationDesc desc;
+      if (!desc.ParseFromArray(data, sz)) {
+        std::cerr << "SegmentationWriter::WriteSegmentation: "
+        << "Could not parse frame for " << filename_ << "\n";
+        return false;
+      }
+      return WriteSegmentation(desc, pts);
+    }
+    
     file_offsets_.push_back(ofs_.tellp());
     time_stamps_.push_back(pts);
     
     ofs_.write(reinterpret_cast<const char*>(&sz), sizeof(sz));
     ofs_.write(reinterpret_cast<const char*>(data), sz);
+    return ofs_.good();
+  }
+  
+  bool SegmentationWriter::WriteSegmentation(const SegmentationDesc& desc, int64_t pts) {
+    if (format_ == SEGMENTATION_FORMAT_RAW) {
+      desc.SerializeToString(&packed_data_);
+      return WriteSegmentation(reinterpret_cast<const uchar*>(packed_data_.data()),
+                               packed_data_.size(), pts);
+    }
+    
+    return WriteCompressed(desc, pts);
+  }
+  
+  bool SegmentationWriter::WriteCompressed(const SegmentationDesc& desc, int64_t pts) {
+    const int frame = file_offsets_.size();
+    const bool delta_frame = UseDeltaFrames() && frame % keyframe_interval_ != 0;
+    
+    PackedSegmentationDesc packed;
+    PackSegmentation(desc, delta_frame ? &previous_desc_ : 0, &packed);
+    packed.SerializeToString(&packed_data_);
+    
+    // The frame is only added once it is compressed, so that a failure leaves
+    // the file and the delta state unchanged.
+    uLongf compressed_sz = compressBound(packed_data_.size());
+    compressed_data_.resize(compressed_sz);
+    if (compress2(&compressed_data_[0], &compressed_sz,
+                  reinterpret_cast<const Bytef*>(packed_data_.data()), packed_data_.size(),
+                  compression_level_) != Z_OK) {
+      std::cerr << "SegmentationWriter::WriteSegmentation: "
+      << "Could not compress frame for " << filename_ << "\n";
+      return false;
+    }
+    
+    if (UseDeltaFrames()) {
+      previous_desc_.CopyFrom(desc);
+    }
+    
+    file_offsets_.push_back(ofs_.tellp());
+    time_stamps_.push_back(pts);
+    
+    const int sz = compressed_sz;
+    const int packed_sz = packed_data_.size();
+    ofs_.write(reinterpret_cast<const char*>(&sz), sizeof(sz));
+    ofs_.write(reinterpret_cast<const char*>(&packed_sz), sizeof(packed_sz));
+    ofs_.write(reinterpret_cast<const char*>(&compressed_data_[0]), sz);
+    return ofs_.good();
   }
   
   bool SegmentationReader::OpenFileAndReadHeader() {
     // Open file.
-    ifs_.open(filename_.c_str(), std::ios_base::in | std::ios_base::binary);
+#ifdef _WIN32
+    fd_ = _open(filename_.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    fd_ = open(filename_.c_str(), O_RDONLY);
+#endif
     
-    if (!ifs_) {
+    if (fd_ < 0) {
       std::cerr << "SegmentationReader::OpenFileAndReadHeader: "
       << "Could not open segmentation file " << filename_ << "\n";
       return false;
@@ -83,38 +472,258 @@ namespace Segment {
     int num_seg_frames;
     int64_t seg_header_offset;
     
-    ifs_.read(reinterpret_cast<char*>(&num_seg_frames), sizeof(num_seg_frames));
-    ifs_.read(reinterpret_cast<char*>(&seg_header_offset), sizeof(seg_header_offset));
+    // Compressed files start with a marker and the version, otherwise the
+    // first field is the number of frames.
+    int64_t header_pos = 0;
+    if (!ReadAt(0, sizeof(num_seg_frames), &num_seg_frames)) {
+      std::cerr << "SegmentationReader::OpenFileAndReadHeader: "
+      << "Could not read header of " << filename_ << "\n";
+      return false;
+    }
+    
+    compressed_ = num_seg_frames == kCompressedFileMarker;
+    keyframe_interval_ = 0;
+    if (compressed_) {
+      int version;
+      if (!ReadAt(sizeof(num_seg_frames), sizeof(version), &version) ||
+          (version != kCompressedFileVersion && version != kDeltaFileVersion)) {
+        std::cerr << "SegmentationReader::OpenFileAndReadHeader: "
+        << "Unsupported version of compressed file " << filename_ << "\n";
+        return false;
+      }
+      header_pos = sizeof(kCompressedFileMarker) + sizeof(version);
+      
+      if (version == kDeltaFileVersion) {
+        if (!ReadAt(header_pos, sizeof(keyframe_interval_), &keyframe_interval_) ||
+            keyframe_interval_ <= 0) {
+          std::cerr << "SegmentationReader::OpenFileAndReadHeader: "
+          << "Invalid keyframe interval in " << filename_ << "\n";
+          return false;
+        }
+        header_pos += sizeof(keyframe_interval_);
+      }
+    }
+    
+    if (!ReadAt(header_pos, sizeof(num_seg_frames), &num_seg_frames) ||
+        !ReadAt(header_pos + sizeof(num_seg_frames), sizeof(seg_header_offset),
+                &seg_header_offset) ||
+        num_seg_frames < 0) {
+      std::cerr << "SegmentationReader::OpenFileAndReadHeader: "
+      << "Could not read header of " << filename_ << "\n";
+      return false;
+    }
     
-    int64_t start_pos = ifs_.tellg();
-    ifs_.seekg(seg_header_offset);
+    const int64_t start_pos = header_pos + sizeof(num_seg_frames) + sizeof(seg_header_offset);
     file_offsets_ = vector<int64_t>(num_seg_frames);
     time_stamps_ = vector<int64_t>(num_seg_frames);
     
+    // Offset and time stamp for each frame.
+    vector<int64_t> header(2 * num_seg_frames);
+    if (num_seg_frames > 0 &&
+        !ReadAt(seg_header_offset, header.size() * sizeof(header[0]), &header[0])) {
+      std::cerr << "SegmentationReader::OpenFileAndReadHeader: "
+      << "Could not read frame offsets of " << filename_ << "\n";
+      return false;
+    }
+    
     for (int i = 0; i < num_seg_frames; ++i) {
-      int64_t pos;
-      int64_t time_stamp;
-      ifs_.read(reinterpret_cast<char*>(&pos), sizeof(pos));
-      ifs_.read(reinterpret_cast<char*>(&time_stamp), sizeof(time_stamp));
-      file_offsets_[i] = pos;
-      time_stamps_[i] = time_stamp;
+      file_offsets_[i] = header[2 * i];
+      time_stamps_[i] = header[2 * i + 1];
     }
     
-    ifs_.seekg(start_pos);    
+    position_ = start_pos;
+    next_frame_ = 0;
+    frame_buffer_.Clear();
     return true;
   }
   
   void SegmentationReader::SeekToFrame(int frame) {
-    ifs_.seekg(file_offsets_[frame]);
+    position_ = file_offsets_[frame];
+    next_frame_ = frame;
   }
   
   int SegmentationReader::ReadFrameSize() {
-    ifs_.read(reinterpret_cast<char*>(&frame_sz_), sizeof(frame_sz_));
+    if (compressed_) {
+      // Frame is decoded here, ReadFrame only copies it.
+      frame_sz_ = 0;
+      if (next_frame_ >= FrameNumber() || !ReadFrame(next_frame_, &frame_buffer_))
+        return frame_sz_;
+      
+      const string data = frame_buffer_.desc.SerializeAsString();
+      frame_data_.assign(data.begin(), data.end());
+      frame_sz_ = frame_data_.size();
+      ++next_frame_;
+      return frame_sz_;
+    }
+    
+    ReadAt(position_, sizeof(frame_sz_), &frame_sz_);
+    position_ += sizeof(frame_sz_);
     return frame_sz_;
   }
   
   void SegmentationReader::ReadFrame(uchar* data) {
-    ifs_.read(reinterpret_cast<char*>(data), frame_sz_);
-  }  
+    if (compressed_) {
+      std::copy(frame_data_.begin(), frame_data_.begin() + frame_sz_, data);
+      return;
+    }
+    
+    ReadAt(position_, frame_sz_, data);
+    position_ += frame_sz_;
+  }
+  
+  bool SegmentationReader::ReadFrame(int frame, vector<uchar>* buffer) const {
+    if (frame < 0 || frame >= FrameNumber())
+      return false;
+    
+    if (compressed_) {
+      FrameBuffer frame_buffer;
+      if (!ReadFrame(frame, &frame_buffer))
+        return false;
+      
+      const string data = frame_buffer.desc.SerializeAsString();
+      buffer->assign(data.begin(), data.end());
+      return true;
+    }
+    
+    const int64_t offset = file_offsets_[frame];
+    int frame_sz;
+    if (!ReadAt(offset, sizeof(frame_sz), &frame_sz) || frame_sz < 0)
+      return false;
+    
+    buffer->resize(frame_sz);
+    return frame_sz == 0 || ReadAt(offset + sizeof(frame_sz), frame_sz, &(*buffer)[0]);
+  }
+  
+  bool SegmentationReader::ReadFrame(int frame, FrameBuffer* buffer) const {
+    if (frame < 0 || frame >= FrameNumber())
+      return false;
+    
+    if (!compressed_) {
+      buffer->frame = -1;
+      if (!ReadFrame(frame, &buffer->data) ||
+          !buffer->desc.ParseFromArray(buffer->data.empty() ? 0 : &buffer->data[0],
+                                       buffer->data.size())) {
+        return false;
+      }
+      buffer->frame = frame;
+      return true;
+    }
+    
+    if (keyframe_interval_ == 0) {
+      buffer->frame = -1;
+      if (!ReadPackedFrame(frame, &buffer->data, &buffer->packed) ||
+          !UnpackSegmentation(buffer->packed, 0, &buffer->desc)) {
+        return false;
+      }
+      buffer->frame = frame;
+      return true;
+    }
+    
+    if (buffer->frame == frame)
+      return true;
+    
+    // Decode from the last keyframe or, if it is in between, from the frame in
+    // buffer.
+    const int keyframe = frame - frame % keyframe_interval_;
+    const int first_frame = buffer->frame >= keyframe && buffer->frame < frame ?
+                            buffer->frame + 1 : keyframe;
+    for (int f = first_frame; f <= frame; ++f) {
+      bool success = ReadPackedFrame(f, &buffer->data, &buffer->packed);
+      if (success && f == keyframe) {
+        success = UnpackSegmentation(buffer->packed, 0, &buffer->desc);
+      } else if (success) {
+        success = UnpackSegmentation(buffer->packed, &buffer->desc, &buffer->decode_desc);
+        buffer->desc.Swap(&buffer->decode_desc);
+      }
+      
+      if (!success) {
+        std::cerr << "SegmentationReader::ReadFrame: "
+        << "Could not decode frame " << f << " of " << filename_ << "\n";
+        buffer->frame = -1;
+        return false;
+      }
+      buffer->frame = f;
+    }
+    return true;
+  }
+  
+  bool SegmentationReader::ReadFrame(int frame, SegmentationDesc* desc) const {
+    if (frame < 0 || frame >= FrameNumber())
+      return false;
+    
+    FrameBuffer frame_buffer;
+    if (!ReadFrame(frame, &frame_buffer))
+      return false;
+    desc->Swap(&frame_buffer.desc);
+    return true;
+  }
+  
+  bool SegmentationReader::ReadPackedFrame(int frame,
+                                           vector<uchar>* scratch,
+                                           PackedSegmentationDesc* packed) const {
+    const int64_t offset = file_offsets_[frame];
+    int sizes[2];  // Compressed and packed size.
+    if (!ReadAt(offset, sizeof(sizes), sizes) || sizes[0] < 0 || sizes[1] < 0)
+      return false;
+    
+    // Compressed data followed by the decompressed PackedSegmentationDesc.
+    scratch->resize((size_t)sizes[0] + sizes[1] + 1);
+    uchar* compressed = &(*scratch)[0];
+    uchar* packed_data = compressed + sizes[0];
+    if (!ReadAt(offset + sizeof(sizes), sizes[0], compressed))
+      return false;
+    
+    uLongf packed_sz = sizes[1];
+    if (sizes[1] > 0 &&
+        (uncompress(packed_data, &packed_sz, compressed, sizes[0]) != Z_OK ||
+         packed_sz != (uLongf)sizes[1])) {
+      std::cerr << "SegmentationReader::ReadFrame: "
+      << "Corrupted frame at offset " << offset << " in " << filename_ << "\n";
+      return false;
+    }
+    
+    return packed->ParseFromArray(packed_data, sizes[1]);
+  }
+  
+  void SegmentationReader::CloseFile() {
+    if (fd_ >= 0) {
+#ifdef _WIN32
+      _close(fd_);
+#else
+      close(fd_);
+#endif
+      fd_ = -1;
+    }
+  }
+  
+  bool SegmentationReader::ReadAt(int64_t offset, int64_t size, void* data) const {
+    char* data_ptr = reinterpret_cast<char*>(data);
+    while (size > 0) {
+#ifdef _WIN32
+      // ReadFile with explicit offset does not depend on the file pointer.
+      OVERLAPPED overlapped;
+      memset(&overlapped, 0, sizeof(overlapped));
+      overlapped.Offset = (DWORD)offset;
+      overlapped.OffsetHigh = (DWORD)(offset >> 32);
+      
+      DWORD bytes_read = 0;
+      const DWORD chunk = (DWORD)std::min<int64_t>(size, 1 << 30);
+      if (!ReadFile((HANDLE)_get_osfhandle(fd_), data_ptr, chunk, &bytes_read, &overlapped) ||
+          bytes_read == 0) {
+        return false;
+      }
+#else
+      const ssize_t bytes_read = pread(fd_, data_ptr, size, offset);
+      if (bytes_read < 0 && errno == EINTR)
+        continue;
+      if (bytes_read <= 0)
+        return false;
+#endif
+      data_ptr += bytes_read;
+      offset += bytes_read;
+      size -= bytes_read;
+    }
+    return true;
+  }
   
 }  // namespace Segment.
\ No newline at end of file
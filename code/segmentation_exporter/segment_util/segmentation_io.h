@@ -22,6 +22,34 @@
 // Header, for every frame:
 //    FileOffset in file : sizeof(int64)
 //    TimeStamp of frame in pts : sizeof(int64)
+//
+// Compressed files (version 2) store each frame as zlib compressed
+// PackedSegmentationDesc (see segmentation.proto), which is typically an
+// order of magnitude smaller. They start with a marker that is never a valid
+// number of frames, the remaining layout is the same:
+//
+// Marker (kCompressedFileMarker) : sizeof(int32)
+// Version (2) : sizeof(int32)
+// Number of frames : sizeof(int32)
+// Offset to header at end of file : sizeof(int64)
+// For every frame
+//    Size of compressed data in bytes : sizeof(int32)
+//    Size of PackedSegmentationDesc in bytes : sizeof(int32)
+//    PackedSegmentationDesc compressed with zlib : from above member
+// Header, for every frame:
+//    FileOffset in file : sizeof(int64)
+//    TimeStamp of frame in pts : sizeof(int64)
+//
+// Compressed files with delta frames (version 3) additionally store the
+// keyframe interval N after the version. Every N-th frame is a keyframe as
+// above, all other frames only store the regions that changed with respect to
+// the previous frame (see PackedSegmentationDesc). Reading a frame therefore
+// requires decoding at most N frames starting at the last keyframe;
+// sequential reads decode each frame once, incrementally from the previous
+// one.
+//
+// SegmentationReader detects the format, old files remain readable and all
+// read functions return the frames as (serialized) SegmentationDesc.
 
 #ifndef SEGMENTATION_IO_H
 #define SEGMENTATION_IO_H
@@ -34,6 +62,8 @@
 
 #include <vector>
 
+#include "segmentation.pb.h"
+
 #ifdef _WIN32
   typedef __int64 int64_t;
 #endif
@@ -44,28 +74,98 @@ namespace Segment {
   using std::string;
   using std::vector;
 
+  enum SegmentationFileFormat {
+    // Serialized SegmentationDesc per frame, readable by all versions.
+    SEGMENTATION_FORMAT_RAW,
+    // Compressed PackedSegmentationDesc per frame.
+    SEGMENTATION_FORMAT_COMPRESSED
+  };
+
+  // First int32 of compressed files.
+  const int kCompressedFileMarker = -0x5345475a;
+  const int kCompressedFileVersion = 2;
+  const int kDeltaFileVersion = 3;
+
   class SegmentationWriter {
   public:
-    SegmentationWriter(const string& filename) : filename_(filename) {}
+    // compression_level is the zlib level (0-9) for compressed files. If
+    // keyframe_interval is > 1, compressed files are written with delta
+    // frames and a keyframe every keyframe_interval frames.
+    SegmentationWriter(const string& filename,
+                       SegmentationFileFormat format = SEGMENTATION_FORMAT_RAW,
+                       int compression_level = 6,
+                       int keyframe_interval = 0)
+        : filename_(filename), format_(format), compression_level_(compression_level),
+          keyframe_interval_(keyframe_interval), header_pos_(0) {}
     
     bool OpenAndPrepareFileHeader();
-    void WriteOffsetsAndClose();
     
-    void FlushAndReopen(const string& filename);
+    // Returns false if any write to the file failed, in which case the file
+    // is not usable.
+    bool WriteOffsetsAndClose();
+    
+    bool FlushAndReopen(const string& filename);
     
-    void WriteSegmentation(const uchar* data, int sz, int64_t pts = 0);
+    // Data is a serialized SegmentationDesc. Returns false on write errors and
+    // if the frame can not be parsed or compressed; such frames are not added.
+    bool WriteSegmentation(const uchar* data, int sz, int64_t pts = 0);
+    bool WriteSegmentation(const SegmentationDesc& desc, int64_t pts = 0);
+    
+  private:
+    bool WriteCompressed(const SegmentationDesc& desc, int64_t pts);
+    bool UseDeltaFrames() const {
+      return format_ == SEGMENTATION_FORMAT_COMPRESSED && keyframe_interval_ > 1;
+    }
     
   private:
     string filename_;
+    SegmentationFileFormat format_;
+    int compression_level_;
+    int keyframe_interval_;
     std::ofstream ofs_;                         
     
+    // Position of the number of frames.
+    int64_t header_pos_;
+    
+    // Reused across frames.
+    string packed_data_;
+    vector<uchar> compressed_data_;
+    
+    // Last written frame, reference for delta frames.
+    SegmentationDesc previous_desc_;
+    
     vector<int64_t> file_offsets_;
     vector<int64_t> time_stamps_; 
   };
   
+  // All reads are positional reads (pread) on a single file descriptor, the
+  // sequential interface below only keeps its own read position.
+  // ReadFrame(int, ...) does not modify any state and can be called
+  // concurrently from multiple threads on one reader.
   class SegmentationReader {
   public:
-    SegmentationReader(const string& filename) : filename_(filename) {}
+    // Per thread state for ReadFrame. Holds the file data and the last
+    // decoded frame, from which the next frame of a file with delta frames is
+    // decoded incrementally. Has to be cleared before it is used with another
+    // reader.
+    struct FrameBuffer {
+      FrameBuffer() : frame(-1) {}
+      void Clear() { frame = -1; desc.Clear(); }
+      
+      // Last frame read, -1 if none.
+      int frame;
+      SegmentationDesc desc;
+      
+      // Scratch for reading and decoding.
+      vector<uchar> data;
+      PackedSegmentationDesc packed;
+      SegmentationDesc decode_desc;
+    };
+    
+    SegmentationReader(const string& filename)
+        : compressed_(false), keyframe_interval_(0), next_frame_(0), frame_sz_(0),
+          position_(0), fd_(-1), filename_(filename) {}
+    ~SegmentationReader() { CloseFile(); }
     
     bool OpenFileAndReadHeader();
     
@@ -74,19 +174,57 @@ namespace Segment {
     int ReadFrameSize();
     void ReadFrame(uchar* data);
     
+    // Thread-safe, reads frame into buffer (resized to the frame's size).
+    // Returns false on read errors and for frames out of range. Frames of
+    // compressed files are decoded and serialized as SegmentationDesc, use the
+    // overloads below to avoid the serialization if the frame is parsed anyway.
+    bool ReadFrame(int frame, vector<uchar>* buffer) const;
+    
+    // Thread-safe, reads and parses frame into buffer->desc, reusing the
+    // buffer's memory. Reading frames in ascending order with the same buffer
+    // decodes each delta frame once. Returns false on read or parse errors.
+    bool ReadFrame(int frame, FrameBuffer* buffer) const;
+    
+    // Same as above for a single frame.
+    bool ReadFrame(int frame, SegmentationDesc* desc) const;
+    
+    // True for files written with SEGMENTATION_FORMAT_COMPRESSED.
+    bool IsCompressed() const { return compressed_; }
+    
+    // Interval of keyframes for files with delta frames, 0 otherwise.
+    int KeyframeInterval() const { return keyframe_interval_; }
+    
     const vector<int64_t>& TimeStamps() { return time_stamps_; }
+    // Offset of each frame's size field within the file.
+    const vector<int64_t>& FileOffsets() const { return file_offsets_; }
     void SeekToFrame(int frame);
     int FrameNumber() const { return file_offsets_.size(); }
-    void CloseFile() { ifs_.close(); }
+    void CloseFile();
+    
+  private:
+    // Reads size bytes at offset, returns false if less bytes could be read.
+    bool ReadAt(int64_t offset, int64_t size, void* data) const;
+    
+    // Reads and decompresses the record of frame into packed.
+    bool ReadPackedFrame(int frame, vector<uchar>* scratch, PackedSegmentationDesc* packed) const;
     
   private:
     vector<int64_t> file_offsets_;
     vector<int64_t> time_stamps_;
     
+    bool compressed_;
+    int keyframe_interval_;
+    
+    // State of the sequential interface for compressed files: next frame and
+    // its serialization after ReadFrameSize.
+    int next_frame_;
+    FrameBuffer frame_buffer_;
+    vector<uchar> frame_data_;
     int frame_sz_;
+    int64_t position_;
     
+    int fd_;
     string filename_;
-    std::ifstream ifs_;
   };
 
 }  // namespace Segment.
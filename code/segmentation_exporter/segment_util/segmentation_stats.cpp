@@ -0,0 +1,227 @@
+/*
+ *  segmentation_stats.cpp
+ *  segment_util
+ *
+ */
+
+#include "segmentation_stats.h"
+#include "assert_log.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+namespace Segment {
+
+  typedef SegmentationDesc::Region SegRegion;
+  typedef SegmentationDesc::Region::Scanline Scanline;
+  typedef SegmentationDesc::Region::Scanline::Interval ScanlineInterval;
+
+  void RegionStats::Merge(const RegionStats& other) {
+    if (!other.IsPresent())
+      return;
+
+    if (!IsPresent()) {
+      *this = other;
+      return;
+    }
+
+    area += other.area;
+    sum_x += other.sum_x;
+    sum_y += other.sum_y;
+    min_x = std::min(min_x, other.min_x);
+    min_y = std::min(min_y, other.min_y);
+    max_x = std::max(max_x, other.max_x);
+    max_y = std::max(max_y, other.max_y);
+    first_frame = std::min(first_frame, other.first_frame);
+    last_frame = std::max(last_frame, other.last_frame);
+  }
+
+  void SegmentationStats::AddFrame(const SegmentationDesc& desc, int frame_number) {
+    ASSURE_LOG(!hierarchy_computed_) << "Frames added after hierarchy was computed.";
+    if (level_stats_.empty())
+      level_stats_.resize(1);
+
+    vector<RegionStats>& leaf_stats = level_stats_[0];
+
+    for (int k = 0, num_regions = desc.region_size(); k < num_regions; ++k) {
+      const SegRegion& r = desc.region(k);
+
+      // Accumulate this frame's slice of the region.
+      RegionStats frame_stats;
+      frame_stats.min_x = frame_stats.min_y = 1 << 30;
+      frame_stats.max_x = frame_stats.max_y = -1;
+
+      int y = r.top_y();
+      for (int s = 0, num_scanlines = r.scanline_size(); s < num_scanlines; ++s, ++y) {
+        const Scanline& scanline = r.scanline(s);
+        for (int i = 0, sz = scanline.interval_size(); i < sz; ++i) {
+          const ScanlineInterval& inter = scanline.interval(i);
+          const int64_t left = inter.left_x();
+          const int64_t right = inter.right_x();
+          const int64_t len = right - left + 1;
+
+          frame_stats.area += len;
+          frame_stats.sum_x += (left + right) * len / 2;
+          frame_stats.sum_y += len * y;
+          frame_stats.min_x = std::min<int>(frame_stats.min_x, left);
+          frame_stats.max_x = std::max<int>(frame_stats.max_x, right);
+          frame_stats.min_y = std::min(frame_stats.min_y, y);
+          frame_stats.max_y = std::max(frame_stats.max_y, y);
+        }
+      }
+
+      if (!frame_stats.IsPresent())
+        continue;
+
+      frame_stats.first_frame = frame_stats.last_frame = frame_number;
+
+      const int id = r.id();
+      if (id >= (int)leaf_stats.size()) {
+        leaf_stats.resize(std::max<int>(id + 1, desc.max_id()));
+        leaf_parent_.resize(leaf_stats.size(), -1);
+      }
+
+      leaf_stats[id].Merge(frame_stats);
+      if (r.has_parent_id())
+        leaf_parent_[id] = r.parent_id();
+    }
+  }
+
+  bool SegmentationStats::ComputeHierarchy(const SegmentationDesc& seg_hier) {
+    if (level_stats_.empty())
+      level_stats_.resize(1);
+
+    level_stats_.resize(seg_hier.hierarchy_size() + 1);
+
+    for (int l = 0; l < seg_hier.hierarchy_size(); ++l) {
+      const SegmentationDesc::Hierarchy& hier = seg_hier.hierarchy(l);
+      const vector<RegionStats>& child_stats = level_stats_[l];
+      vector<RegionStats>& parent_stats = level_stats_[l + 1];
+      parent_stats.clear();
+      parent_stats.resize(std::max<int>(hier.max_id(), hier.region_size()));
+
+      for (int id = 0; id < (int)child_stats.size(); ++id) {
+        if (!child_stats[id].IsPresent())
+          continue;
+
+        int parent_id;
+        if (l == 0) {
+          parent_id = leaf_parent_[id];
+        } else {
+          const SegmentationDesc::Hierarchy& child_hier = seg_hier.hierarchy(l - 1);
+          if (id >= child_hier.region_size()) {
+            std::cerr << "SegmentationStats::ComputeHierarchy: "
+                      << "Region " << id << " of level " << l << " is missing in the "
+                      << "hierarchy.\n";
+            return false;
+          }
+          parent_id = child_hier.region(id).has_parent_id() ? child_hier.region(id).parent_id()
+                                                             : -1;
+        }
+
+        if (parent_id < 0)
+          continue;
+
+        if (parent_id >= (int)parent_stats.size())
+          parent_stats.resize(parent_id + 1);
+
+        parent_stats[parent_id].Merge(child_stats[id]);
+      }
+    }
+
+    hierarchy_computed_ = true;
+    return true;
+  }
+
+  bool SegmentationStats::WriteCSV(const string& filename) const {
+    std::ofstream ofs(filename.c_str(), std::ios_base::out | std::ios_base::trunc);
+    if (!ofs) {
+      std::cerr << "SegmentationStats::WriteCSV: "
+                << "Could not open " << filename << " to write!\n";
+      return false;
+    }
+
+    ofs << "level,id,area,min_x,min_y,max_x,max_y,centroid_x,centroid_y,"
+        << "first_frame,last_frame\n";
+    for (int l = 0; l < NumLevels(); ++l) {
+      const vector<RegionStats>& stats = level_stats_[l];
+      for (int id = 0; id < (int)stats.size(); ++id) {
+        const RegionStats& s = stats[id];
+        if (!s.IsPresent())
+          continue;
+
+        ofs << l << "," << id << "," << s.area << ","
+            << s.min_x << "," << s.min_y << "," << s.max_x << "," << s.max_y << ","
+            << s.CentroidX() << "," << s.CentroidY() << ","
+            << s.first_frame << "," << s.last_frame << "\n";
+      }
+    }
+
+    return ofs.good();
+  }
+
+  bool SegmentationStats::WriteBinary(const string& filename) const {
+    std::ofstream ofs(filename.c_str(),
+                      std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!ofs) {
+      std::cerr << "SegmentationStats::WriteBinary: "
+                << "Could not open " << filename << " to write!\n";
+      return false;
+    }
+
+    ofs.write("SGST", 4);
+    int num_levels = NumLevels();
+    ofs.write(reinterpret_cast<const char*>(&num_levels), sizeof(num_levels));
+
+    for (int l = 0; l < num_levels; ++l) {
+      const vector<RegionStats>& stats = level_stats_[l];
+      int num_present = 0;
+      for (int id = 0; id < (int)stats.size(); ++id) {
+        if (stats[id].IsPresent())
+          ++num_present;
+      }
+      ofs.write(reinterpret_cast<const char*>(&num_present), sizeof(num_present));
+
+      for (int id = 0; id < (int)stats.size(); ++id) {
+        const RegionStats& s = stats[id];
+        if (!s.IsPresent())
+          continue;
+
+        const int ints[3] = { id, s.first_frame, s.last_frame };
+        const int bbox[4] = { s.min_x, s.min_y, s.max_x, s.max_y };
+        const float centroid[2] = { s.CentroidX(), s.CentroidY() };
+        ofs.write(reinterpret_cast<const char*>(ints), sizeof(ints));
+        ofs.write(reinterpret_cast<const char*>(&s.area), sizeof(s.area));
+        ofs.write(reinterpret_cast<const char*>(bbox), sizeof(bbox));
+        ofs.write(reinterpret_cast<const char*>(centroid), sizeof(centroid));
+      }
+    }
+
+    return ofs.good();
+  }
+
+  bool ComputeSegmentationStats(SegmentationReader* reader, SegmentationStats* stats) {
+    if (reader->FrameNumber() == 0)
+      return false;
+
+    SegmentationDesc seg_hier;
+    SegmentationReader::FrameBuffer frame_buffer;
+    for (int f = 0; f < reader->FrameNumber(); ++f) {
+      if (!reader->ReadFrame(f, &frame_buffer)) {
+        std::cerr << "ComputeSegmentationStats: Could not read frame " << f << "\n";
+        return false;
+      }
+
+      const SegmentationDesc& desc = frame_buffer.desc;
+      stats->AddFrame(desc, f);
+
+      // Hierarchy is only saved in the first frame.
+      if (f == 0)
+        seg_hier.mutable_hierarchy()->CopyFrom(desc.hierarchy());
+    }
+
+    return stats->ComputeHierarchy(seg_hier);
+  }
+
+}  // namespace Segment.
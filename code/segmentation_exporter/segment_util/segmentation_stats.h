@@ -0,0 +1,109 @@
+/*
+ *  segmentation_stats.h
+ *  segment_util
+ *
+ *  Per-region statistics computed directly from the scanline representation.
+ *
+ */
+
+// Accumulates area, bounding box, centroid and temporal extent for every
+// region at every hierarchy level in a single pass over a segmentation file.
+// Statistics are computed exactly from top_y and the scanline intervals,
+// without rasterizing any frame. Over-segmentation (level 0) statistics are
+// accumulated per frame and subsequently rolled up to all ancestors using the
+// hierarchy.
+
+#ifndef SEGMENTATION_STATS_H__
+#define SEGMENTATION_STATS_H__
+
+#include "segmentation.pb.h"
+#include "segmentation_io.h"
+
+#include <string>
+#include <vector>
+
+namespace Segment {
+  using std::string;
+  using std::vector;
+
+  struct RegionStats {
+    RegionStats() : area(0), sum_x(0), sum_y(0), min_x(0), min_y(0), max_x(0), max_y(0),
+                    first_frame(-1), last_frame(-1) {}
+
+    // Returns true if the region covers at least one pixel.
+    bool IsPresent() const { return area > 0; }
+
+    // Merges statistics of other into this one.
+    void Merge(const RegionStats& other);
+
+    float CentroidX() const { return area ? (float)((double)sum_x / area) : 0; }
+    float CentroidY() const { return area ? (float)((double)sum_y / area) : 0; }
+
+    // Number of pixels over all frames.
+    int64_t area;
+    // Sum of pixel coordinates, used for centroid computation.
+    int64_t sum_x;
+    int64_t sum_y;
+
+    // Bounding box (inclusive) over all frames.
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+
+    // Temporal extent (inclusive).
+    int first_frame;
+    int last_frame;
+  };
+
+  class SegmentationStats {
+  public:
+    SegmentationStats() : hierarchy_computed_(false) {}
+
+    // Accumulates statistics of all over-segmentation regions in desc.
+    void AddFrame(const SegmentationDesc& desc, int frame_number);
+
+    // Rolls up accumulated over-segmentation statistics to every level of
+    // seg_hier. Call after all frames have been added. Returns false if
+    // seg_hier does not contain a present region.
+    bool ComputeHierarchy(const SegmentationDesc& seg_hier);
+
+    // Number of levels including the over-segmentation.
+    int NumLevels() const { return level_stats_.size(); }
+
+    // Statistics indexed by region id. Regions that are not present in the
+    // video have zero area.
+    const vector<RegionStats>& LevelStats(int level) const { return level_stats_[level]; }
+
+    // Writes one line per present region:
+    // level,id,area,min_x,min_y,max_x,max_y,centroid_x,centroid_y,first_frame,last_frame
+    bool WriteCSV(const string& filename) const;
+
+    // Compact binary table. Format:
+    // Magic "SGST" : 4 bytes
+    // Number of levels : sizeof(int32)
+    // For every level
+    //    Number of present regions : sizeof(int32)
+    //    For every present region
+    //       id, first_frame, last_frame : 3 * sizeof(int32)
+    //       area : sizeof(int64)
+    //       min_x, min_y, max_x, max_y : 4 * sizeof(int32)
+    //       centroid_x, centroid_y : 2 * sizeof(float)
+    bool WriteBinary(const string& filename) const;
+
+  private:
+    // Index 0 holds over-segmentation statistics.
+    vector<vector<RegionStats> > level_stats_;
+    // Over-segmentation region id to parent id at level 1.
+    vector<int> leaf_parent_;
+    bool hierarchy_computed_;
+  };
+
+  // Reads every frame of an opened reader once and computes statistics for all
+  // levels. Hierarchy is expected in the first frame. Returns false if reader
+  // contains no frames, a frame can not be read or the hierarchy is malformed.
+  bool ComputeSegmentationStats(SegmentationReader* reader, SegmentationStats* stats);
+
+}  // namespace Segment.
+
+#endif  // SEGMENTATION_STATS_H__
@@ -11,6 +11,8 @@
 #include "assert_log.h"
 
 #include <algorithm>
+#include <cstring>
+#include <stdlib.h>
 #include <google/protobuf/repeated_field.h>
 using google::protobuf::RepeatedPtrField;
 
@@ -21,6 +23,11 @@ typedef unsigned char uchar;
   #undef max
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define SEGMENT_UTIL_USE_SSE2
+#endif
+
 // Moved from imagefilter here to remove library dependency.
 namespace {
   template <class T>
@@ -47,143 +54,393 @@ namespace Segment {
   typedef SegmentationDesc::Region::Scanline Scanline;
   typedef SegmentationDesc::Region::Scanline::Interval ScanlineInterval;
   
-  void SegmentationDescToIdImage(int* img,
-                                 int width_step,
-                                 int width,
-                                 int height,
-                                 int level,
-                                 const SegmentationDesc& seg, 
-                                 const SegmentationDesc* seg_hier) {
+  namespace {
+    // Minimum span length in elements for non-temporal stores.
+    const int kNonTemporalSpanLength = 64;
     
-    if (level > 0 && seg.hierarchy_size() != 0) {
-      // Is a hierarchy present at the current frame?
-      seg_hier = &seg;
-    }
+    // Span fills.
+    // Each fills len consecutive pixels starting at dst.
     
-    if (level)
-      level = std::min(level, seg_hier->hierarchy_size());
+    template <class T>
+    inline void FillSpan(T* dst, int len, T value) {
+      std::fill(dst, dst + len, value);
+    }
     
-    ASSURE_LOG(level == 0 || seg_hier) << "Hierarchy requested but not found.";
-    ASSURE_LOG(level == 0 || level <= seg_hier->hierarchy_size()) << "Requested hierarchy exceeds"
-        << " levels supplied in seg or seg_hier.";
+    inline void FillSpan(uchar* dst, int len, uchar value) {
+      memset(dst, value, len);
+    }
     
-    // Fill each region with it's id.
-    const RepeatedPtrField<SegRegion>& regions = seg.region();
-    for (RepeatedPtrField<SegRegion>::const_iterator r = regions.begin();
-         r != regions.end();
-         ++r) {
-      
-           
-      // Get id.
-      int region_id;
-      if (level == 0)
-        region_id = r->id();
-      else {
-        // Traverse to parent region.
-        int parent_id = r->parent_id();
-        
-        for (int l = 0; l < level - 1; ++l) {
-          ASSERT_LOG(seg_hier->hierarchy(l).region_size() >= parent_id);
-          parent_id = seg_hier->hierarchy(l).region(parent_id).parent_id();
+    // 32-bit pixels, optionally bypassing the cache. Vector stores are only used
+    // if dst is 4-byte aligned, otherwise it could never reach 16-byte alignment.
+    inline void FillSpan32(int* dst, int len, int value, bool non_temporal) {
+#ifdef SEGMENT_UTIL_USE_SSE2
+      if (len >= 8 && (reinterpret_cast<size_t>(dst) & 3) == 0) {
+        // Align to 16 bytes.
+        for (; len > 0 && (reinterpret_cast<size_t>(dst) & 15); ++dst, --len) {
+          *dst = value;
         }
         
-        region_id = parent_id;
+        const __m128i v = _mm_set1_epi32(value);
+        if (non_temporal && len >= kNonTemporalSpanLength) {
+          for (; len >= 4; len -= 4, dst += 4) {
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst), v);
+          }
+        } else {
+          for (; len >= 4; len -= 4, dst += 4) {
+            _mm_store_si128(reinterpret_cast<__m128i*>(dst), v);
+          }
+        }
+      }
+#endif
+      for (; len > 0; --len, ++dst) {
+        *dst = value;
+      }
+    }
+    
+    // 3-channel 8-bit pixels. Color is replicated to a 48 byte (16 pixel)
+    // pattern once per region.
+    struct BGRPattern {
+      explicit BGRPattern(const uchar* color = 0) {
+        if (color) {
+          Set(color);
+        }
       }
       
-      const RepeatedPtrField<Scanline>& scanlines = r->scanline();
-      int* dst_ptr = PtrOffset(img, r->top_y() * width_step);
-      
-      for(RepeatedPtrField<Scanline>::const_iterator s = scanlines.begin();
-          s != scanlines.end();
-          ++s) {
-        for (int i = 0, sz = s->interval_size(); i < sz; ++i) {
-          const ScanlineInterval& inter = s->interval(i);
-          int* out_ptr = dst_ptr + inter.left_x();
-          for (int j = 0, len = inter.right_x() - inter.left_x() + 1; j < len; ++j, ++out_ptr) {
-            *out_ptr = region_id;
-          }
+      void Set(const uchar* color) {
+        for (int i = 0; i < 48; i += 3) {
+          bytes[i] = color[0];
+          bytes[i + 1] = color[1];
+          bytes[i + 2] = color[2];
         }
-        dst_ptr = PtrOffset(dst_ptr, width_step);
       }
-    }  
-  }
-  
-  
-  void RenderRegionsRandomColor(char* img,
-                                int width_step,
-                                int width,
-                                int height,
-                                int level,
-                                bool highlight_boundary,
-                                const SegmentationDesc& seg,
-                                const SegmentationDesc* seg_hier) {
-    // Clear image.
-    memset(img, 0, width_step * height);
+      
+      uchar bytes[48];
+    };
     
-    if (level > 0 && seg.hierarchy_size() != 0) {
-      // Is a hierarchy present at the current frame?
-      seg_hier = &seg;
+    inline void FillSpanBGR(char* dst, int len, const BGRPattern& pattern) {
+#ifdef SEGMENT_UTIL_USE_SSE2
+      if (len >= 16) {
+        const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern.bytes));
+        const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern.bytes + 16));
+        const __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern.bytes + 32));
+        for (; len >= 16; len -= 16, dst += 48) {
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), p0);
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), p1);
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 32), p2);
+        }
+      }
+#else
+      for (; len >= 16; len -= 16, dst += 48) {
+        memcpy(dst, pattern.bytes, 48);
+      }
+#endif
+      for (; len > 0; --len, dst += 3) {
+        dst[0] = pattern.bytes[0];
+        dst[1] = pattern.bytes[1];
+        dst[2] = pattern.bytes[2];
+      }
     }
     
-    if (level)
-      level = std::min(level, seg_hier->hierarchy_size());
+    // Use region id as seed. Thread-safe: glibc's rand() shares one state
+    // across threads, random_r with the default state size produces the same
+    // sequence from a local state. The MSVC runtime keeps a per-thread state.
+    void RandomRegionColor(int region_id, uchar* color) {
+#ifdef __GLIBC__
+      char state[128];
+      random_data data;
+      memset(&data, 0, sizeof(data));
+      initstate_r(region_id, state, sizeof(state), &data);
+      for (int c = 0; c < 3; ++c) {
+        int32_t value;
+        random_r(&data, &value);
+        color[c] = (uchar) (value % 255);
+      }
+#else
+      srand(region_id);
+      color[0] = (uchar) (rand() % 255);
+      color[1] = (uchar) (rand() % 255);
+      color[2] = (uchar) (rand() % 255);
+#endif
+    }
     
-    ASSURE_LOG(level == 0 || seg_hier) << "Hierarchy requested but not found.";
+    // Fillers.
+    // The rasterizer calls SetRegion(region_id) once per region, which returns
+    // false if the region is not rendered, followed by
+    // operator()(row, left, right) for each of the region's spans.
     
-    // Fill each region.
-    const RepeatedPtrField<SegRegion>& regions = seg.region();
-    for(RepeatedPtrField<SegRegion>::const_iterator r = regions.begin();
-        r != regions.end();
-        ++r) {
-      // Get color.
-      uchar color[3];
+    // Writes region ids into a 32-bit image.
+    struct IdFiller {
+      IdFiller(int* img_, int width_step_, bool non_temporal_)
+          : img(img_), width_step(width_step_), non_temporal(non_temporal_), region_id(0) {}
+      
+      bool SetRegion(int id) {
+        region_id = id;
+        return true;
+      }
       
+      void operator()(int row, int left, int right) {
+        FillSpan32(PtrOffset(img, row * width_step) + left, right - left + 1, region_id,
+                   non_temporal);
+      }
+      
+      int* img;
+      int width_step;
+      bool non_temporal;
       int region_id;
+    };
+    
+    // Writes random region colors into a 3-channel 8-bit image.
+    struct RandomColorFiller {
+      RandomColorFiller(char* img_, int width_step_) : img(img_), width_step(width_step_) {}
       
-      if (level == 0)
-        region_id = r->id();
-      else {
-        // Traverse to parent region.
-        int parent_id = r->parent_id();
-        
-        for (int l = 1; l < level; ++l) {
-          assert(seg_hier->hierarchy(l-1).region_size() > parent_id);
-          parent_id = seg_hier->hierarchy(l-1).region(parent_id).parent_id();
+      bool SetRegion(int id) {
+        uchar color[3];
+        RandomRegionColor(id, color);
+        pattern.Set(color);
+        return true;
+      }
+      
+      void operator()(int row, int left, int right) {
+        FillSpanBGR(img + row * width_step + left * 3, right - left + 1, pattern);
+      }
+      
+      char* img;
+      int width_step;
+      BGRPattern pattern;
+    };
+    
+    // Same as RandomColorFiller with colors memoized per region id, as
+    // RandomRegionColor is costly compared to filling small regions. The cache
+    // holds 4 bytes per id, the color followed by a flag if it was computed.
+    struct CachedRandomColorFiller {
+      CachedRandomColorFiller(char* img_, int width_step_, vector<uchar>* cache_)
+          : img(img_), width_step(width_step_), cache(cache_) {}
+      
+      bool SetRegion(int id) {
+        if (id < 0) {
+          uchar color[3];
+          RandomRegionColor(id, color);
+          pattern.Set(color);
+          return true;
         }
         
-        region_id = parent_id;
+        if (4 * id >= (int)cache->size())
+          cache->resize(4 * (id + 1), 0);
+        
+        uchar* color = &(*cache)[4 * id];
+        if (!color[3]) {
+          RandomRegionColor(id, color);
+          color[3] = 1;
+        }
+        pattern.Set(color);
+        return true;
       }
       
-      // Use region id as seed.
-      srand(region_id);
-      color[0] = (uchar) (rand() % 255);
-      color[1] = (uchar) (rand() % 255);
-      color[2] = (uchar) (rand() % 255);
+      void operator()(int row, int left, int right) {
+        FillSpanBGR(img + row * width_step + left * 3, right - left + 1, pattern);
+      }
+      
+      char* img;
+      int width_step;
+      vector<uchar>* cache;
+      BGRPattern pattern;
+    };
+    
+    // Writes num_channels label values per pixel, consecutive pixels are
+    // pixel_stride elements apart. Dense single channel and packed 32-bit
+    // pixels (e.g. RGBA) use the vectorized span fills.
+    template <class T>
+    struct LabelSpanFill {
+      LabelSpanFill(T* img_, int width_step_, int pixel_stride_, int num_channels_,
+                    const T* values_)
+          : img(img_), width_step(width_step_), pixel_stride(pixel_stride_),
+            num_channels(num_channels_), values(values_) {
+        packed_32 = pixel_stride == num_channels && sizeof(T) * num_channels == 4;
+        if (packed_32) {
+          memcpy(&packed_value, values, 4);
+        }
+      }
+      
+      void operator()(int row, int left, int right) {
+        T* out_ptr = PtrOffset(img, row * width_step) + left * pixel_stride;
+        const int len = right - left + 1;
+        if (pixel_stride == 1 && num_channels == 1) {
+          FillSpan(out_ptr, len, values[0]);
+        } else if (packed_32 && (reinterpret_cast<size_t>(out_ptr) & 3) == 0) {
+          // Rows with an unaligned base or width_step take the generic path.
+          FillSpan32(reinterpret_cast<int*>(out_ptr), len, packed_value, false);
+        } else if (num_channels == 1) {
+          const T value = values[0];
+          for (int j = 0; j < len; ++j, out_ptr += pixel_stride) {
+            *out_ptr = value;
+          }
+        } else {
+          for (int j = 0; j < len; ++j, out_ptr += pixel_stride) {
+            for (int c = 0; c < num_channels; ++c) {
+              out_ptr[c] = values[c];
+            }
+          }
+        }
+      }
       
-      const RepeatedPtrField<Scanline>& scanlines = r->scanline();
-      char* dst_ptr =img + width_step * r->top_y();
+      T* img;
+      int width_step;
+      int pixel_stride;
+      int num_channels;
+      const T* values;
+      bool packed_32;
+      int packed_value;
+    };
+    
+    // Renders a region into every target that has a label for it.
+    template <class T>
+    struct LabelFiller {
+      explicit LabelFiller(const vector<LabelRenderTarget<T> >& targets_) : targets(targets_) {}
       
-      for(RepeatedPtrField<Scanline>::const_iterator s = scanlines.begin();
-          s != scanlines.end();
-          ++s) {
-        for (int i = 0, sz = s->interval_size(); i < sz; ++i) {
-          const ScanlineInterval& inter = s->interval(i);
-          char* out_ptr = dst_ptr + inter.left_x() * 3;
-          for (int j = 0, len = inter.right_x() - inter.left_x() + 1;
-               j < len;
-               ++j, out_ptr += 3) {
-            out_ptr[0] = color[0];
-            out_ptr[1] = color[1];
-            out_ptr[2] = color[2];
+      bool SetRegion(int id) {
+        fills.clear();
+        for (int t = 0, num_targets = targets.size(); t < num_targets; ++t) {
+          const LabelRenderTarget<T>& target = targets[t];
+          if (target.labels->HasLabel(id)) {
+            fills.push_back(LabelSpanFill<T>(target.img,
+                                             target.width_step,
+                                             target.pixel_stride,
+                                             target.labels->NumChannels(),
+                                             target.labels->Label(id)));
           }
         }
-        dst_ptr += width_step;
+        return !fills.empty();
+      }
+      
+      void operator()(int row, int left, int right) {
+        for (int i = 0, sz = fills.size(); i < sz; ++i) {
+          fills[i](row, left, right);
+        }
+      }
+      
+      const vector<LabelRenderTarget<T> >& targets;
+      vector<LabelSpanFill<T> > fills;
+    };
+    
+    // Rasterization engine.
+    
+    // Accumulates a 64-bit multiplicative hash of region ids and spans.
+    struct HashFiller {
+      HashFiller() : hash(0) {}
+      
+      void Add(int value) {
+        hash = (hash ^ (unsigned int)value) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 32;
       }
+      
+      bool SetRegion(int id) {
+        // Separates regions, spans always have non-negative coordinates.
+        Add(-1);
+        Add(id);
+        return true;
+      }
+      
+      void operator()(int row, int left, int right) {
+        Add(row);
+        Add(left);
+        Add(right);
+      }
+      
+      uint64_t hash;
+    };
+    
+    // Returns true if region r covers any scanline of roi.
+    inline bool RegionIntersectsRows(const SegRegion& r, const RenderRect& roi) {
+      const int top_y = r.top_y();
+      return top_y < roi.y + roi.height && top_y + r.scanline_size() > roi.y;
     }
     
-    // Edge highlight post-process.
-    if (highlight_boundary) {
-      for (int i = 0; i < height - 1; ++i) {
+    // Calls span_fun(row, left, right) for each interval of region r clipped to roi.
+    // Only every scale'th row and column of roi is sampled, starting with the
+    // top-left corner of roi. Row and interval bounds are sampled coordinates
+    // relative to roi, right is inclusive.
+    template <class SpanFun>
+    void ForEachSpanInRect(const SegRegion& r,
+                           const RenderRect& roi,
+                           int scale,
+                           SpanFun& span_fun) {
+      const int first = std::max<int>(roi.y, r.top_y());
+      const int last = std::min<int>(roi.y + roi.height, r.top_y() + r.scanline_size());
+      const int roi_right = roi.x + roi.width - 1;
+      
+      // Advance to first sampled row.
+      int row = (first - roi.y + scale - 1) / scale;
+      for (int y = roi.y + row * scale; y < last; y += scale, ++row) {
+        const Scanline& s = r.scanline(y - r.top_y());
+        for (int i = 0, sz = s.interval_size(); i < sz; ++i) {
+          const ScanlineInterval& inter = s.interval(i);
+          const int left = std::max<int>(inter.left_x(), roi.x);
+          const int right = std::min<int>(inter.right_x(), roi_right);
+          if (left > right)
+            continue;
+          
+          // Map to sampled columns.
+          const int left_col = (left - roi.x + scale - 1) / scale;
+          const int right_col = (right - roi.x) / scale;
+          if (left_col <= right_col) {
+            span_fun(row, left_col, right_col);
+          }
+        }
+      }
+    }
+    
+    template <bool kOverSegmentation, class Filler>
+    void RasterizeRegions(const RenderRect& roi,
+                          int scale,
+                          int level,
+                          const SegmentationDesc& seg,
+                          const SegmentationDesc* seg_hier,
+                          Filler& filler) {
+      const RepeatedPtrField<SegRegion>& regions = seg.region();
+      for (RepeatedPtrField<SegRegion>::const_iterator r = regions.begin();
+           r != regions.end();
+           ++r) {
+        if (!RegionIntersectsRows(*r, roi))
+          continue;
+        
+        const int region_id = kOverSegmentation ? r->id() : AncestorId(*r, level, seg_hier);
+        if (filler.SetRegion(region_id)) {
+          ForEachSpanInRect(*r, roi, scale, filler);
+        }
+      }
+    }
+    
+    // Renders all regions of seg within roi at 1 / scale resolution at the
+    // specified level through filler. Over-segmentation and hierarchy levels are
+    // compiled separately.
+    template <class Filler>
+    void Rasterize(const RenderRect& roi,
+                   int scale,
+                   int level,
+                   const SegmentationDesc& seg,
+                   const SegmentationDesc* seg_hier,
+                   Filler& filler) {
+      ASSURE_LOG(scale >= 1) << "Scale has to be positive.";
+      
+      seg_hier = ResolveHierarchy(seg, seg_hier, &level);
+      if (level == 0) {
+        RasterizeRegions<true>(roi, scale, level, seg, seg_hier, filler);
+      } else {
+        RasterizeRegions<false>(roi, scale, level, seg, seg_hier, filler);
+      }
+    }
+    
+    // Colors pixels black whose right or bottom neighbor differs in color.
+    // Processes the first num_rows rows of img. If has_next_row is set, img
+    // contains one more row which bottom neighbors are compared against,
+    // otherwise the last row is the image's bottom row.
+    void HighlightBoundary(char* img, int width_step, int width, int num_rows,
+                           bool has_next_row) {
+      if (num_rows <= 0)
+        return;
+      
+      const int rows_with_bottom = has_next_row ? num_rows : num_rows - 1;
+      for (int i = 0; i < rows_with_bottom; ++i) {
         char* row_ptr = img + i * width_step;
         for (int j = 0; j < width - 1; ++j, row_ptr += 3) {
           if (ColorDiff_L1(row_ptr, row_ptr + 3) != 0 ||
@@ -196,13 +453,63 @@ namespace Segment {
           row_ptr[0] = row_ptr[1] = row_ptr[2] = 0;
       }
       
+      if (has_next_row)
+        return;
+      
       // Last row.
-      char* row_ptr = img + width_step * (height - 1);
+      char* row_ptr = img + width_step * (num_rows - 1);
       for (int j = 0; j < width - 1; ++j, row_ptr += 3) {
         if (ColorDiff_L1(row_ptr, row_ptr + 3) != 0)
           row_ptr[0] = row_ptr[1] = row_ptr[2] = 0;
       }      
-    }    
+    }
+  }  // namespace.
+  
+  const SegmentationDesc* ResolveHierarchy(const SegmentationDesc& seg,
+                                           const SegmentationDesc* seg_hier,
+                                           int* level) {
+    if (*level > 0 && seg.hierarchy_size() != 0) {
+      // Is a hierarchy present at the current frame?
+      seg_hier = &seg;
+    }
+    
+    ASSURE_LOG(*level == 0 || seg_hier) << "Hierarchy requested but not found.";
+    
+    if (*level)
+      *level = std::min(*level, seg_hier->hierarchy_size());
+    return seg_hier;
+  }
+  
+  int AncestorId(const SegRegion& r, int level, const SegmentationDesc* seg_hier) {
+    int parent_id = r.parent_id();
+    for (int l = 0; l < level - 1; ++l) {
+      ASSERT_LOG(seg_hier->hierarchy(l).region_size() > parent_id);
+      parent_id = seg_hier->hierarchy(l).region(parent_id).parent_id();
+    }
+    return parent_id;
+  }
+  
+  void SegmentationDescToIdImage(int* img,
+                                 int width_step,
+                                 int width,
+                                 int height,
+                                 int level,
+                                 const SegmentationDesc& seg, 
+                                 const SegmentationDesc* seg_hier) {
+    SegmentationDescToIdImageScaled(img, width_step, RenderRect(0, 0, width, height), 1,
+                                    level, seg, seg_hier);
+  }
+  
+  void RenderRegionsRandomColor(char* img,
+                                int width_step,
+                                int width,
+                                int height,
+                                int level,
+                                bool highlight_boundary,
+                                const SegmentationDesc& seg,
+                                const SegmentationDesc* seg_hier) {
+    RenderRegionsRandomColorScaled(img, width_step, RenderRect(0, 0, width, height), 1,
+                                   level, highlight_boundary, seg, seg_hier);
   }
   
   int GetRegionIdFromPoint(int x, int y, int level, const SegmentationDesc& seg,
@@ -254,7 +561,6 @@ namespace Segment {
     return -1;
   }
   
-  
   void RenderRegions(const vector<int>& region_ids,
                      uchar color,
                      uchar* img,
@@ -265,154 +571,331 @@ namespace Segment {
                      int level,
                      const SegmentationDesc& seg,
                      const SegmentationDesc* seg_hier) {
+    RenderRegionsROI(region_ids, color, img, width_step, RenderRect(0, 0, width, height),
+                     num_colors, level, seg, seg_hier);
+  }
+  
+  void RenderRegions(const vector<std::pair<int, uchar> >& region_color_pairs,
+                     uchar* img,
+                     int width_step,
+                     int width,
+                     int height,
+                     int num_colors,
+                     int level,
+                     const SegmentationDesc& seg,
+                     const SegmentationDesc* seg_hier) {
+    RegionLabelTable<uchar> labels;
+    for (vector<std::pair<int, uchar> >::const_iterator region = region_color_pairs.begin();
+         region != region_color_pairs.end();
+         ++region) {
+      labels.SetLabel(region->first, region->second);
+    }
     
-    // Make sure region_ids is sorted.
-    vector<int> region_ids_sorted(region_ids);
-    std::sort(region_ids_sorted.begin(), region_ids_sorted.end());
+    vector<LabelRenderTarget<uchar> > targets(
+        1, LabelRenderTarget<uchar>(img, width_step, num_colors, &labels));
+    RenderRegionLabels(targets, RenderRect(0, 0, width, height), level, seg, seg_hier);
+  }
+  
+  void SegmentationDescToIdImageScaled(int* img,
+                                       int width_step,
+                                       const RenderRect& roi,
+                                       int scale,
+                                       int level,
+                                       const SegmentationDesc& seg,
+                                       const SegmentationDesc* seg_hier,
+                                       bool non_temporal) {
+    IdFiller filler(img, width_step, non_temporal);
+    Rasterize(roi, scale, level, seg, seg_hier, filler);
     
-    if (level > 0 && seg.hierarchy_size() != 0) {
-      // Is a hierarchy present at the current frame?
-      seg_hier = &seg;
+#ifdef SEGMENT_UTIL_USE_SSE2
+    if (non_temporal) {
+      _mm_sfence();
     }
+#endif
+  }
+  
+  void RenderRegionsRandomColorScaled(char* img,
+                                      int width_step,
+                                      const RenderRect& roi,
+                                      int scale,
+                                      int level,
+                                      bool highlight_boundary,
+                                      const SegmentationDesc& seg,
+                                      const SegmentationDesc* seg_hier) {
+    const int scaled_width = ScaledSize(roi.width, scale);
+    const int scaled_height = ScaledSize(roi.height, scale);
     
-    if (level)
-      level = std::min(level, seg_hier->hierarchy_size());
+    // Clear image.
+    memset(img, 0, width_step * scaled_height);
     
-    ASSURE_LOG(level == 0 || seg_hier) << "Hierarchy requested but not found.";
-    ASSURE_LOG(level == 0 || level <= seg_hier->hierarchy_size()) << "Requested hierarchy exceeds"
-       << " levels supplied in seg or seg_hier.";
+    RandomColorFiller filler(img, width_step);
+    Rasterize(roi, scale, level, seg, seg_hier, filler);
     
-
-    // Mark each region found in region_ids with color.
-    const RepeatedPtrField<SegRegion>& regions = seg.region();
-    for(RepeatedPtrField<SegRegion>::const_iterator r = regions.begin();
-        r != regions.end();
-        ++r) {
+    // Edge highlight post-process.
+    if (highlight_boundary) {
+      HighlightBoundary(img, width_step, scaled_width, scaled_height, false);
+    }
+  }
+  
+  uint64_t RenderedContentHash(const RenderRect& roi,
+                               int scale,
+                               int level,
+                               const SegmentationDesc& seg,
+                               const SegmentationDesc* seg_hier) {
+    HashFiller filler;
+    Rasterize(roi, scale, level, seg, seg_hier, filler);
+    return filler.hash;
+  }
+  
+  bool BandRenderer::RenderRegionsRandomColor(const RenderRect& roi,
+                                              int scale,
+                                              int level,
+                                              bool highlight_boundary,
+                                              const SegmentationDesc& seg,
+                                              const SegmentationDesc* seg_hier,
+                                              RenderBandConsumer* consumer) {
+    // Boundaries of a band's last row depend on the first row of the next band.
+    const int lookahead = highlight_boundary ? 1 : 0;
+    if (!IndexRegions(roi, scale, level, 3, lookahead, seg, seg_hier))
+      return true;
+    
+    CachedRandomColorFiller filler(&band_[0], width_step_, &color_cache_);
+    for (int b = 0; b < NumBands(); ++b) {
+      const int first_row = b * rows_per_band_;
+      const int num_rows = std::min(rows_per_band_, height_ - first_row);
+      const int rendered_rows = RenderedRows(b);
       
-      // Get id.
-      int region_id;
-      if (level == 0)
-        region_id = r->id();
-      else {
-        // Traverse to parent region.
-        int parent_id = r->parent_id();
-        
-        for (int l = 0; l < level-1; ++l) {
-          ASSERT_LOG(seg_hier->hierarchy(l).region_size() > parent_id);
-          parent_id = seg_hier->hierarchy(l).region(parent_id).parent_id();
-        }
-        
-        region_id = parent_id;
+      memset(&band_[0], 0, width_step_ * rendered_rows);
+      RasterizeBand(b, seg, filler);
+      if (highlight_boundary) {
+        HighlightBoundary(&band_[0], width_step_, width_, num_rows, rendered_rows > num_rows);
       }
       
-      vector<int>::const_iterator pos = std::lower_bound(region_ids_sorted.begin(),
-                                                         region_ids_sorted.end(), region_id);
-      if (pos != region_ids_sorted.end() && *pos == region_id) {
+      if (!consumer->ConsumeBand(&band_[0], width_step_, first_row, num_rows))
+        return false;
+    }
+    return true;
+  }
+  
+  bool BandRenderer::SegmentationDescToIdImage(const RenderRect& roi,
+                                               int scale,
+                                               int level,
+                                               const SegmentationDesc& seg,
+                                               const SegmentationDesc* seg_hier,
+                                               RenderBandConsumer* consumer) {
+    if (!IndexRegions(roi, scale, level, sizeof(int), 0, seg, seg_hier))
+      return true;
+    
+    IdFiller filler(reinterpret_cast<int*>(&band_[0]), width_step_, false);
+    for (int b = 0; b < NumBands(); ++b) {
+      const int first_row = b * rows_per_band_;
+      const int num_rows = RenderedRows(b);
       
-        const RepeatedPtrField<Scanline>& scanlines = r->scanline();
-        uchar* dst_ptr = PtrOffset(img, r->top_y() * width_step);
+      // All bits set, i.e. -1.
+      memset(&band_[0], 0xff, width_step_ * num_rows);
+      RasterizeBand(b, seg, filler);
       
-        for(RepeatedPtrField<Scanline>::const_iterator s = scanlines.begin();
-            s != scanlines.end();
-            ++s) {
-          for (int i = 0, sz = s->interval_size(); i < sz; ++i) {
-            const ScanlineInterval& inter = s->interval(i);
-            uchar* out_ptr = dst_ptr + inter.left_x() * num_colors;
-            for (int j = 0, len = inter.right_x() - inter.left_x() + 1;
-                 j < len;
-                 ++j, out_ptr+=num_colors) {
-              *out_ptr = color;
-            }
-          }
-
-          dst_ptr = PtrOffset(dst_ptr, width_step);
-        }
-      }
-    }  
+      if (!consumer->ConsumeBand(&band_[0], width_step_, first_row, num_rows))
+        return false;
+    }
+    return true;
   }
   
-  typedef std::pair<int, uchar> RegionColor;
-  struct RegionColorComp : public std::binary_function<bool, RegionColor, RegionColor> {
-        
-    bool operator()(const RegionColor& r1, const RegionColor& r2) {
-      return r1.first < r2.first;
-    }
+  bool BandRenderer::IndexRegions(const RenderRect& roi,
+                                  int scale,
+                                  int level,
+                                  int pixel_bytes,
+                                  int lookahead,
+                                  const SegmentationDesc& seg,
+                                  const SegmentationDesc* seg_hier) {
+    ASSURE_LOG(scale >= 1) << "Scale has to be positive.";
+    seg_hier = ResolveHierarchy(seg, seg_hier, &level);
     
-  };  
-  
-  void RenderRegions(const vector<std::pair<int, uchar> >& region_color_pairs,
-                     uchar* img,
-                     int width_step,
-                     int width,
-                     int height,
-                     int num_colors,
-                     int level,
-                     const SegmentationDesc& seg,
-                     const SegmentationDesc* seg_hier) {
+    roi_ = roi;
+    scale_ = scale;
+    width_ = ScaledSize(roi.width, scale);
+    height_ = ScaledSize(roi.height, scale);
+    width_step_ = width_ * pixel_bytes;
+    lookahead_ = lookahead;
+    if (width_ <= 0 || height_ <= 0)
+      return false;
     
-    // Make sure region_ids is sorted.
-    vector<RegionColor> region_ids_sorted(region_color_pairs);
-    std::sort(region_ids_sorted.begin(), region_ids_sorted.end(), RegionColorComp());
+    rows_per_band_ = band_rows_ > 0 ? band_rows_ : std::max(1, kDefaultBandBytes / width_step_);
+    rows_per_band_ = std::min(rows_per_band_, height_);
+    band_.resize(width_step_ * (rows_per_band_ + lookahead_));
     
-    if (level > 0 && seg.hierarchy_size() != 0) {
-      // Is a hierarchy present at the current frame?
-      seg_hier = &seg;
+    // Bucket regions by band in compressed sparse row layout: count, prefix
+    // sum, then fill using band_start_[b] as insert position for band b.
+    const int num_bands = (height_ + rows_per_band_ - 1) / rows_per_band_;
+    const int num_regions = seg.region_size();
+    band_start_.assign(num_bands + 1, 0);
+    region_ids_.resize(num_regions);
+    
+    int first_band;
+    int last_band;
+    for (int k = 0; k < num_regions; ++k) {
+      const SegRegion& r = seg.region(k);
+      if (!RegionBands(r, &first_band, &last_band))
+        continue;
+      
+      region_ids_[k] = level == 0 ? r.id() : AncestorId(r, level, seg_hier);
+      for (int b = first_band; b <= last_band; ++b) {
+        ++band_start_[b + 1];
+      }
     }
     
-    if (level)
-      level = std::min(level, seg_hier->hierarchy_size());
+    for (int b = 0; b < num_bands; ++b) {
+      band_start_[b + 1] += band_start_[b];
+    }
     
-    ASSURE_LOG(level == 0 || seg_hier) << "Hierarchy requested but not found.";
-    ASSURE_LOG(level == 0 || level <= seg_hier->hierarchy_size()) << "Requested hierarchy exceeds"
-    << " levels supplied in seg or seg_hier.";
+    band_regions_.resize(band_start_.back());
+    for (int k = 0; k < num_regions; ++k) {
+      if (!RegionBands(seg.region(k), &first_band, &last_band))
+        continue;
+      for (int b = first_band; b <= last_band; ++b) {
+        band_regions_[band_start_[b]++] = k;
+      }
+    }
     
+    // Insert positions advanced to the start of the next band, shift back.
+    for (int b = num_bands; b > 0; --b) {
+      band_start_[b] = band_start_[b - 1];
+    }
+    band_start_[0] = 0;
+    return true;
+  }
+  
+  bool BandRenderer::RegionBands(const SegRegion& r, int* first_band, int* last_band) const {
+    const int first = std::max<int>(roi_.y, r.top_y());
+    const int last = std::min<int>(roi_.y + roi_.height, r.top_y() + r.scanline_size());
+    if (first >= last)
+      return false;
     
-    // Mark each region found in region_ids with color.
-    const RepeatedPtrField<SegRegion>& regions = seg.region();
-    for(RepeatedPtrField<SegRegion>::const_iterator r = regions.begin();
-        r != regions.end();
-        ++r) {
-      
-      // Get id.
-      int region_id;
-      if (level == 0)
-        region_id = r->id();
-      else {
-        // Traverse to parent region.
-        int parent_id = r->parent_id();
-        
-        for (int l = 0; l < level - 1; ++l) {
-          ASSERT_LOG(seg_hier->hierarchy(l).region_size() > parent_id);
-          parent_id = seg_hier->hierarchy(l).region(parent_id).parent_id();
-        }
-        
-        region_id = parent_id;
+    // Sampled rows covered by the region.
+    const int first_row = (first - roi_.y + scale_ - 1) / scale_;
+    const int last_row = (last - 1 - roi_.y) / scale_;
+    if (first_row > last_row)
+      return false;
+    
+    // Bands also render the first lookahead_ rows of their successor.
+    *first_band = std::max(0, first_row - lookahead_) / rows_per_band_;
+    *last_band = last_row / rows_per_band_;
+    return true;
+  }
+  
+  int BandRenderer::RenderedRows(int band) const {
+    return std::min(rows_per_band_ + lookahead_, height_ - band * rows_per_band_);
+  }
+  
+  template <class Filler>
+  void BandRenderer::RasterizeBand(int band, const SegmentationDesc& seg, Filler& filler) const {
+    // Band in frame coordinates, starting at a sampled row of roi.
+    const int band_y = roi_.y + band * rows_per_band_ * scale_;
+    const RenderRect band_rect(roi_.x,
+                               band_y,
+                               roi_.width,
+                               std::min(RenderedRows(band) * scale_, roi_.y + roi_.height - band_y));
+    
+    for (int i = band_start_[band]; i < band_start_[band + 1]; ++i) {
+      const int k = band_regions_[i];
+      if (filler.SetRegion(region_ids_[k])) {
+        ForEachSpanInRect(seg.region(k), band_rect, scale_, filler);
       }
-      
-      vector<std::pair<int, uchar> >::const_iterator pos =
-          std::lower_bound(region_ids_sorted.begin(), region_ids_sorted.end(),
-                           std::make_pair(region_id, 0), RegionColorComp());
-      if (pos != region_ids_sorted.end() && pos->first == region_id) {
-        uchar color = pos->second;
-        const RepeatedPtrField<Scanline>& scanlines = r->scanline();
-        uchar* dst_ptr = PtrOffset(img, r->top_y() * width_step);
-        
-        for(RepeatedPtrField<Scanline>::const_iterator s = scanlines.begin();
-            s != scanlines.end();
-            ++s) {
-          for (int i = 0, sz = s->interval_size(); i < sz; ++i) {
-            const ScanlineInterval& inter = s->interval(i);
-            uchar* out_ptr = dst_ptr + inter.left_x() * num_colors;
-            for (int j = 0, len = inter.right_x() - inter.left_x() + 1;
-                 j < len;
-                 ++j, out_ptr+=num_colors) {
-              *out_ptr = color;
-            }
-          }
-          
-          dst_ptr = PtrOffset(dst_ptr, width_step);
+    }
+  }
+  
+  void SegmentationDescToIdImageROI(int* img,
+                                    int width_step,
+                                    const RenderRect& roi,
+                                    int level,
+                                    const SegmentationDesc& seg,
+                                    const SegmentationDesc* seg_hier) {
+    SegmentationDescToIdImageScaled(img, width_step, roi, 1, level, seg, seg_hier);
+  }
+  
+  void RenderRegionsRandomColorROI(char* img,
+                                   int width_step,
+                                   const RenderRect& roi,
+                                   int level,
+                                   bool highlight_boundary,
+                                   const SegmentationDesc& seg,
+                                   const SegmentationDesc* seg_hier) {
+    RenderRegionsRandomColorScaled(img, width_step, roi, 1, level, highlight_boundary,
+                                   seg, seg_hier);
+  }
+  
+  void RenderRegionsROI(const vector<int>& region_ids,
+                        uchar color,
+                        uchar* img,
+                        int width_step,
+                        const RenderRect& roi,
+                        int num_colors,
+                        int level,
+                        const SegmentationDesc& seg,
+                        const SegmentationDesc* seg_hier) {
+    RegionLabelTable<uchar> labels;
+    for (vector<int>::const_iterator id = region_ids.begin(); id != region_ids.end(); ++id) {
+      labels.SetLabel(*id, color);
+    }
+    
+    vector<LabelRenderTarget<uchar> > targets(
+        1, LabelRenderTarget<uchar>(img, width_step, num_colors, &labels));
+    RenderRegionLabels(targets, roi, level, seg, seg_hier);
+  }
+  
+  template <class T>
+  void RenderRegionLabels(const vector<LabelRenderTarget<T> >& targets,
+                          const RenderRect& roi,
+                          int level,
+                          const SegmentationDesc& seg,
+                          const SegmentationDesc* seg_hier) {
+    LabelFiller<T> filler(targets);
+    Rasterize(roi, 1, level, seg, seg_hier, filler);
+  }
+  
+  // Explicit instantiations.
+  template void RenderRegionLabels<uchar>(const vector<LabelRenderTarget<uchar> >&,
+                                          const RenderRect&, int, const SegmentationDesc&,
+                                          const SegmentationDesc*);
+  template void RenderRegionLabels<unsigned short>(
+      const vector<LabelRenderTarget<unsigned short> >&, const RenderRect&, int,
+      const SegmentationDesc&, const SegmentationDesc*);
+  template void RenderRegionLabels<int>(const vector<LabelRenderTarget<int> >&,
+                                        const RenderRect&, int, const SegmentationDesc&,
+                                        const SegmentationDesc*);
+  template void RenderRegionLabels<float>(const vector<LabelRenderTarget<float> >&,
+                                          const RenderRect&, int, const SegmentationDesc&,
+                                          const SegmentationDesc*);
+  
+  void RenderRegionSets(const vector<vector<int> >& region_sets,
+                        uchar color,
+                        uchar* img,
+                        int width_step,
+                        const RenderRect& roi,
+                        int level,
+                        const SegmentationDesc& seg,
+                        const SegmentationDesc* seg_hier) {
+    const int num_sets = region_sets.size();
+    RegionLabelTable<uchar> labels(num_sets);
+    
+    // Channel k of a region's label is set iff region is in region_sets[k].
+    vector<uchar> values(num_sets);
+    for (int k = 0; k < num_sets; ++k) {
+      for (vector<int>::const_iterator id = region_sets[k].begin();
+           id != region_sets[k].end();
+           ++id) {
+        if (labels.HasLabel(*id)) {
+          std::copy(labels.Label(*id), labels.Label(*id) + num_sets, values.begin());
+        } else {
+          std::fill(values.begin(), values.end(), 0);
         }
+        values[k] = color;
+        labels.SetLabelValues(*id, &values[0]);
       }
-    }  
+    }
+    
+    vector<LabelRenderTarget<uchar> > targets(
+        1, LabelRenderTarget<uchar>(img, width_step, num_sets, &labels));
+    RenderRegionLabels(targets, roi, level, seg, seg_hier);
   }
-}
\ No newline at end of file
+}
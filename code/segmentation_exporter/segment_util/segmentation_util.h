@@ -11,9 +11,14 @@
 #define SEGMENTATION_UTIL_H__
 
 #include "segmentation.pb.h"
+#include <algorithm>
 #include <vector>
+#ifdef __linux
+  #include <stdint.h>
+#endif
 
 #ifdef _WIN32
+typedef unsigned __int64 uint64_t;
 #include <hash_map>
 #else
 #include <ext/hash_map>
@@ -61,6 +66,19 @@ namespace Segment {
                                 const SegmentationDesc& desc,
                                 const SegmentationDesc* seg_hier = 0);
   
+  // Returns the hierarchy to use for level: desc itself if it contains one,
+  // otherwise seg_hier. Thresholds level to the levels present in it.
+  const SegmentationDesc* ResolveHierarchy(const SegmentationDesc& desc,
+                                           const SegmentationDesc* seg_hier,
+                                           int* hierarchy_level);
+  
+  // Returns the id of the ancestor of over-segmentation region r at
+  // hierarchy_level > 0, which is expected to be thresholded by
+  // ResolveHierarchy.
+  int AncestorId(const SegmentationDesc::Region& r,
+                 int hierarchy_level,
+                 const SegmentationDesc* seg_hier);
+  
   // Returns region_id at corresponding (x, y) location in image,
   // return value -1 indicates error.
   int GetRegionIdFromPoint(int x,
@@ -69,7 +87,298 @@ namespace Segment {
                            const SegmentationDesc& seg,
                            const SegmentationDesc* seg_hier = 0);  
   
-  // DEPRECATED
+  // Region of interest (crop) rendering.
+  // The following functions only render the pixels within roi. The passed image
+  // has to be of size roi.width x roi.height; pixel (0, 0) corresponds to
+  // (roi.x, roi.y) in the frame. Regions and scanline intervals outside of
+  // roi are skipped, therefore cost scales with the area of roi and not with
+  // the frame size.
+  struct RenderRect {
+    RenderRect() : x(0), y(0), width(0), height(0) {}
+    RenderRect(int x_, int y_, int width_, int height_)
+        : x(x_), y(y_), width(width_), height(height_) {}
+
+    int x;
+    int y;
+    int width;
+    int height;
+  };
+
+  // Same as SegmentationDescToIdImage restricted to roi.
+  void SegmentationDescToIdImageROI(int* img,
+                                    int width_step,
+                                    const RenderRect& roi,
+                                    int hierarchy_level,
+                                    const SegmentationDesc& desc,
+                                    const SegmentationDesc* seg_hier = 0);
+
+  // Same as RenderRegionsRandomColor restricted to roi. Boundaries are
+  // highlighted within roi only, i.e. the borders of roi are treated as frame
+  // borders.
+  void RenderRegionsRandomColorROI(char* img,
+                                   int width_step,
+                                   const RenderRect& roi,
+                                   int hierarchy_level,
+                                   bool highlight_boundary,
+                                   const SegmentationDesc& desc,
+                                   const SegmentationDesc* seg_hier = 0);
+
+  // Downscaled rendering.
+  // Renders roi directly at 1 / scale of its resolution (scale = 2, 4, 8, ...)
+  // by point sampling, i.e. pixel (x, y) of img corresponds to
+  // (roi.x + x * scale, roi.y + y * scale) in the frame. Only sampled scanlines
+  // are visited and intervals are mapped to the sampled columns, no full
+  // resolution image is created. The passed image has to be of size
+  // ScaledSize(roi.width, scale) x ScaledSize(roi.height, scale).
+  inline int ScaledSize(int size, int scale) { return (size + scale - 1) / scale; }
+  
+  // If non_temporal is set, long spans are written bypassing the cache. Only
+  // beneficial for images exceeding the cache size that are not read
+  // immediately afterwards.
+  void SegmentationDescToIdImageScaled(int* img,
+                                       int width_step,
+                                       const RenderRect& roi,
+                                       int scale,
+                                       int hierarchy_level,
+                                       const SegmentationDesc& desc,
+                                       const SegmentationDesc* seg_hier = 0,
+                                       bool non_temporal = false);
+  
+  // Boundaries are highlighted on the downscaled image.
+  void RenderRegionsRandomColorScaled(char* img,
+                                      int width_step,
+                                      const RenderRect& roi,
+                                      int scale,
+                                      int hierarchy_level,
+                                      bool highlight_boundary,
+                                      const SegmentationDesc& desc,
+                                      const SegmentationDesc* seg_hier = 0);
+  
+  // Returns a 64-bit hash of everything that determines the rendering of roi
+  // at 1 / scale and the specified level: the (ancestor) region id and sampled
+  // spans of each visible region, in rendering order. Frames or levels with
+  // equal hashes render to identical images with any of the functions above,
+  // which can be used to skip rendering and encoding of duplicates.
+  // The hash is not collision-free: n different contents collide with a
+  // probability of about n^2 / 2^65 (3e-8 for a million outputs), in which case
+  // a duplicate replaces an actual image. Callers that can not accept this have
+  // to compare rendered images instead.
+  uint64_t RenderedContentHash(const RenderRect& roi,
+                               int scale,
+                               int hierarchy_level,
+                               const SegmentationDesc& desc,
+                               const SegmentationDesc* seg_hier = 0);
+
+  // Band-tiled rendering.
+  // At 4K a single id image is 33 MB, so every full frame pass (rasterization,
+  // boundary highlighting, encoding) misses the cache. A BandRenderer renders
+  // roi at 1 / scale in bands of rows that fit into the L2 cache and hands each
+  // finished band to a RenderBandConsumer (e.g. an image encoder) while it is
+  // still in cache. The regions touching each band are determined once per
+  // frame from their top_y and number of scanlines, no full size image is
+  // created. Results are identical to the corresponding *Scaled functions.
+
+  // Receives the rows of a rendered image band by band, from top to bottom.
+  class RenderBandConsumer {
+  public:
+    virtual ~RenderBandConsumer() {}
+
+    // Passes num_rows rows of the image starting at first_row, width_step bytes
+    // apart. Rows are only valid during the call. Return false to abort
+    // rendering.
+    virtual bool ConsumeBand(const char* rows, int width_step, int first_row, int num_rows) = 0;
+  };
+
+  class BandRenderer {
+  public:
+    // Band size if the number of rows is not specified, leaves room in a 256 KB
+    // L2 cache for the consumer's state.
+    static const int kDefaultBandBytes = 192 * 1024;
+
+    // Renders band_rows rows at a time, 0 selects about kDefaultBandBytes per
+    // band.
+    explicit BandRenderer(int band_rows = 0) : band_rows_(band_rows) {}
+
+    void set_band_rows(int band_rows) { band_rows_ = band_rows; }
+
+    // Same as RenderRegionsRandomColorScaled, bands hold 3-channel 8-bit rows.
+    // Returns false if consumer aborted.
+    bool RenderRegionsRandomColor(const RenderRect& roi,
+                                  int scale,
+                                  int hierarchy_level,
+                                  bool highlight_boundary,
+                                  const SegmentationDesc& desc,
+                                  const SegmentationDesc* seg_hier,
+                                  RenderBandConsumer* consumer);
+
+    // Same as SegmentationDescToIdImageScaled, bands hold 32-bit region ids.
+    // Pixels not covered by any region are set to -1.
+    bool SegmentationDescToIdImage(const RenderRect& roi,
+                                   int scale,
+                                   int hierarchy_level,
+                                   const SegmentationDesc& desc,
+                                   const SegmentationDesc* seg_hier,
+                                   RenderBandConsumer* consumer);
+
+  private:
+    // Sets up the band layout for roi and assigns the regions of desc to the
+    // bands they touch. Each band is rendered with lookahead extra rows of the
+    // next band. Returns false if the rendered image is empty.
+    bool IndexRegions(const RenderRect& roi,
+                      int scale,
+                      int hierarchy_level,
+                      int pixel_bytes,
+                      int lookahead,
+                      const SegmentationDesc& desc,
+                      const SegmentationDesc* seg_hier);
+
+    // Returns the range of bands touched by region, false if none.
+    bool RegionBands(const SegmentationDesc::Region& region, int* first_band, int* last_band) const;
+
+    int NumBands() const { return band_start_.size() - 1; }
+
+    // Rows of the band buffer rendered for band, including lookahead rows.
+    int RenderedRows(int band) const;
+
+    // Renders the regions of band into band_ through filler.
+    template <class Filler>
+    void RasterizeBand(int band, const SegmentationDesc& desc, Filler& filler) const;
+
+    int band_rows_;
+
+    // Layout of the current image.
+    RenderRect roi_;
+    int scale_;
+    int width_;
+    int height_;
+    int width_step_;
+    int rows_per_band_;
+    int lookahead_;
+
+    vector<char> band_;
+
+    // Regions touching band b are band_regions_[band_start_[b] ..
+    // band_start_[b + 1]), as indices into desc.region() in ascending order.
+    vector<int> band_start_;
+    vector<int> band_regions_;
+
+    // Rendered id (at the requested level) of each region of desc.
+    vector<int> region_ids_;
+
+    // Random colors by region id, kept across frames.
+    vector<uchar> color_cache_;
+  };
+
+  // Same as RenderRegions restricted to roi.
+  void RenderRegionsROI(const vector<int>& region_ids,
+                        uchar color,
+                        uchar* img,
+                        int width_step,
+                        const RenderRect& roi,
+                        int num_colors,
+                        int hierarchy_level,
+                        const SegmentationDesc& desc,
+                        const SegmentationDesc* seg_hier = 0);
+
+  // Label rendering.
+  // Renders regions through a lookup table from region id (at the rendered
+  // hierarchy level) to a value of NumChannels() components, e.g. a binary
+  // mask value, an integer label or an RGBA color. The table is directly
+  // indexed by region id, negative ids can not be labeled.
+  template <class T>
+  class RegionLabelTable {
+  public:
+    explicit RegionLabelTable(int num_channels = 1) : num_channels_(num_channels) {}
+
+    // Sets all channels of region_id to value. Ignored for negative ids.
+    void SetLabel(int region_id, T value) {
+      if (!Reserve(region_id))
+        return;
+      std::fill(values_.begin() + region_id * num_channels_,
+                values_.begin() + (region_id + 1) * num_channels_, value);
+      has_label_[region_id] = 1;
+    }
+
+    // Sets the channels of region_id to values[0 .. NumChannels()). Ignored for
+    // negative ids.
+    void SetLabelValues(int region_id, const T* values) {
+      if (!Reserve(region_id))
+        return;
+      std::copy(values, values + num_channels_, values_.begin() + region_id * num_channels_);
+      has_label_[region_id] = 1;
+    }
+
+    bool HasLabel(int region_id) const {
+      return region_id >= 0 && region_id < (int)has_label_.size() && has_label_[region_id];
+    }
+
+    // Returns the channels of region_id, 0 for ids outside of the table.
+    const T* Label(int region_id) const {
+      if (region_id < 0 || region_id >= (int)has_label_.size())
+        return 0;
+      return &values_[region_id * num_channels_];
+    }
+
+    int NumChannels() const { return num_channels_; }
+
+  private:
+    // Grows the table to contain region_id, returns false for negative ids.
+    bool Reserve(int region_id) {
+      if (region_id < 0)
+        return false;
+      if (region_id >= (int)has_label_.size()) {
+        has_label_.resize(region_id + 1, 0);
+        values_.resize((region_id + 1) * num_channels_, T());
+      }
+      return true;
+    }
+
+    int num_channels_;
+    vector<T> values_;
+    vector<uchar> has_label_;
+  };
+
+  // Output image for RenderRegionLabels. Each pixel occupies pixel_stride
+  // elements of type T, the first labels->NumChannels() of which are written.
+  // The image has to be of size roi.width x roi.height.
+  template <class T>
+  struct LabelRenderTarget {
+    LabelRenderTarget(T* img_,
+                      int width_step_,
+                      int pixel_stride_,
+                      const RegionLabelTable<T>* labels_)
+        : img(img_), width_step(width_step_), pixel_stride(pixel_stride_), labels(labels_) {}
+
+    T* img;
+    int width_step;
+    int pixel_stride;
+    const RegionLabelTable<T>* labels;
+  };
+
+  // Renders all targets in one traversal of desc. The region id and hierarchy
+  // parent is resolved once per region, pixels of regions without a label in a
+  // target's table are left untouched. Instantiated for uchar, unsigned short,
+  // int and float.
+  template <class T>
+  void RenderRegionLabels(const vector<LabelRenderTarget<T> >& targets,
+                          const RenderRect& roi,
+                          int hierarchy_level,
+                          const SegmentationDesc& desc,
+                          const SegmentationDesc* seg_hier = 0);
+
+  // Renders K masks in one traversal into a K-channel 8-bit image (channel k
+  // is set to color for regions in region_sets[k], zero otherwise). Pixels of
+  // regions in none of the sets are left untouched.
+  void RenderRegionSets(const vector<vector<int> >& region_sets,
+                        uchar color,
+                        uchar* img,
+                        int width_step,
+                        const RenderRect& roi,
+                        int hierarchy_level,
+                        const SegmentationDesc& desc,
+                        const SegmentationDesc* seg_hier = 0);
+
+  // DEPRECATED, use RenderRegionLabels.
   // Render the specified region_ids with 1 channel color in multi-channel image.
   void RenderRegions(const vector<int>& region_ids,
                      uchar color,
@@ -81,7 +390,7 @@ namespace Segment {
                      int hierarchy_level,
                      const SegmentationDesc& desc,
                      const SegmentationDesc* seg_hier = 0);
-  // DEPRECATED  
+  // DEPRECATED, use RenderRegionLabels.
   // Render the specified regions region_ids with associated 1 channel color.
   void RenderRegions(const vector<std::pair<int, uchar> >& region_color_pairs,
                      uchar* img,
@@ -0,0 +1,214 @@
+/*
+ *  main.cpp
+ *  segmentation_client
+ *
+ *  Minimal client for the render server of the segmentation_exporter
+ *  (segmentation_exporter INPUT_FILE_NAME --serve=SOCKET, see
+ *  segmentation_exporter/render_server.h for the protocol).
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+  double CurrentTime() {
+    timeval time;
+    gettimeofday(&time, 0);
+    return time.tv_sec + time.tv_usec * 1e-6;
+  }
+
+  // Buffered reads from a socket.
+  class SocketReader {
+  public:
+    explicit SocketReader(int fd) : fd_(fd), pos_(0), end_(0) {}
+
+    bool ReadLine(std::string* line) {
+      line->clear();
+      char c;
+      while (ReadBytes(&c, 1)) {
+        if (c == '\n')
+          return true;
+        *line += c;
+      }
+      return false;
+    }
+
+    bool ReadBytes(char* data, int sz) {
+      while (sz > 0) {
+        if (pos_ == end_) {
+          const ssize_t received = recv(fd_, buffer_, sizeof(buffer_), 0);
+          if (received < 0 && errno == EINTR)
+            continue;
+          if (received <= 0)
+            return false;
+          pos_ = 0;
+          end_ = received;
+        }
+
+        const int num_bytes = std::min(sz, end_ - pos_);
+        memcpy(data, buffer_ + pos_, num_bytes);
+        pos_ += num_bytes;
+        data += num_bytes;
+        sz -= num_bytes;
+      }
+      return true;
+    }
+
+  private:
+    int fd_;
+    char buffer_[64 * 1024];
+    int pos_;
+    int end_;
+  };
+
+  bool SendAll(int fd, const std::string& data) {
+    const char* ptr = data.data();
+    size_t sz = data.size();
+    while (sz > 0) {
+      const ssize_t sent = send(fd, ptr, sz, 0);
+      if (sent < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      ptr += sent;
+      sz -= sent;
+    }
+    return true;
+  }
+
+  // Sends request and reads the response. Returns false if the connection
+  // failed, error responses are returned in status.
+  bool Request(int fd,
+               SocketReader* reader,
+               const std::string& request,
+               std::string* status,
+               std::vector<char>* payload) {
+    payload->clear();
+    if (!SendAll(fd, request + "\n") || !reader->ReadLine(status))
+      return false;
+
+    if (status->compare(0, 3, "OK ") == 0) {
+      payload->resize(atoi(status->c_str() + 3));
+      if (!payload->empty() && !reader->ReadBytes(&(*payload)[0], payload->size()))
+        return false;
+    }
+    return true;
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    std::cout << "Usage: segmentation_client SOCKET [OPTIONS] [REQUEST]\n"
+              << "Sends REQUEST (e.g. RENDER 10 2) to a server started with\n"
+              << "segmentation_exporter INPUT_FILE_NAME --serve=SOCKET. Without REQUEST,\n"
+              << "one request per line is read from stdin. Text responses are printed,\n"
+              << "status and latency go to stderr.\n"
+              << "Options:\n"
+              << "  --output=FILE  Write the image or mask of the last response to FILE.\n"
+              << "  --repeat=N     Send each request N times, report the mean latency.\n";
+    return 1;
+  }
+
+  const std::string socket_path(argv[1]);
+  std::string output_filename;
+  int repeat = 1;
+  std::string request;
+  for (int i = 2; i < argc; ++i) {
+    const std::string arg(argv[i]);
+    if (arg.compare(0, 9, "--output=") == 0) {
+      output_filename = arg.substr(9);
+    } else if (arg.compare(0, 9, "--repeat=") == 0) {
+      repeat = atoi(arg.c_str() + 9);
+      if (repeat < 1) {
+        std::cerr << "Invalid repeat count: " << arg << "\n";
+        return 1;
+      }
+    } else {
+      request += (request.empty() ? "" : " ") + arg;
+    }
+  }
+
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Socket path " << socket_path << " is too long.\n";
+    return 1;
+  }
+  strcpy(address.sun_path, socket_path.c_str());
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+    std::cerr << "Could not connect to " << socket_path << ": " << strerror(errno) << "\n";
+    return 1;
+  }
+
+  std::vector<std::string> requests;
+  if (!request.empty()) {
+    requests.push_back(request);
+  } else {
+    std::string line;
+    while (std::getline(std::cin, line)) {
+      if (!line.empty())
+        requests.push_back(line);
+    }
+  }
+
+  SocketReader reader(fd);
+  std::string status;
+  std::vector<char> payload;
+  // Payload of the last image or mask response, written to --output.
+  std::vector<char> image;
+  bool success = true;
+  for (std::vector<std::string>::const_iterator r = requests.begin(); r != requests.end(); ++r) {
+    const double start_time = CurrentTime();
+    for (int k = 0; k < repeat; ++k) {
+      if (!Request(fd, &reader, *r, &status, &payload)) {
+        std::cerr << "Connection to server lost.\n";
+        close(fd);
+        return 1;
+      }
+    }
+    const double latency = (CurrentTime() - start_time) / repeat;
+
+    std::cerr << *r << ": " << status << " (" << latency * 1e3 << " ms)\n";
+    if (status.compare(0, 2, "OK") != 0) {
+      success = false;
+      continue;
+    }
+
+    // Images and masks are binary, all other payloads are text lines.
+    const bool is_image = r->compare(0, 7, "RENDER ") == 0 || r->compare(0, 5, "MASK ") == 0;
+    if (is_image) {
+      image.swap(payload);
+    } else if (!payload.empty()) {
+      std::cout.write(&payload[0], payload.size());
+    }
+  }
+  close(fd);
+
+  if (!output_filename.empty() && !image.empty()) {
+    std::ofstream ofs(output_filename.c_str(),
+                      std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    ofs.write(&image[0], image.size());
+    if (!ofs) {
+      std::cerr << "Could not write " << output_filename << "\n";
+      return 1;
+    }
+  }
+
+  return success ? 0 : 1;
+}
@@ -0,0 +1 @@
+set(DEPENDENT_PACKAGES assert_log segment_util)
@@ -0,0 +1,152 @@
+/*
+ *  main.cpp
+ *  segmentation_converter
+ *
+ *  Converts segmentation files between the raw and the compressed container
+ *  format (see segmentation_io.h).
+ *
+ */
+
+#include <stdlib.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "segmentation_io.h"
+
+using namespace Segment;
+
+namespace {
+  int64_t FileSize(const std::string& filename) {
+    std::ifstream ifs(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+    ifs.seekg(0, std::ios_base::end);
+    return ifs.tellg();
+  }
+
+  // Decodes every frame of output_filename and compares it to the frame of
+  // the opened input, so that a lossy conversion is detected before the input
+  // is discarded. Returns false on the first difference.
+  bool VerifyOutput(SegmentationReader* input, const std::string& output_filename) {
+    SegmentationReader output(output_filename);
+    if (!output.OpenFileAndReadHeader()) {
+      return false;
+    }
+
+    if (output.FrameNumber() != input->FrameNumber() ||
+        output.TimeStamps() != input->TimeStamps()) {
+      std::cerr << "Verification failed: " << output_filename
+                << " differs in number of frames or time stamps.\n";
+      return false;
+    }
+
+    // Frames are read in order, so both readers continue delta decoding from
+    // the previous frame as the exporter does. Serialization of equal messages
+    // is identical, which also covers fields set to their default value.
+    SegmentationReader::FrameBuffer input_buffer;
+    SegmentationReader::FrameBuffer output_buffer;
+    for (int f = 0; f < input->FrameNumber(); ++f) {
+      if (!input->ReadFrame(f, &input_buffer) || !output.ReadFrame(f, &output_buffer)) {
+        std::cerr << "Verification failed: Could not read frame " << f << ".\n";
+        return false;
+      }
+
+      if (input_buffer.desc.SerializeAsString() != output_buffer.desc.SerializeAsString()) {
+        std::cerr << "Verification failed: Frame " << f << " of " << output_filename
+                  << " differs from the input.\n";
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cout << "Usage: segmentation_converter INPUT_FILE_NAME OUTPUT_FILE_NAME [OPTIONS]\n"
+              << "Reads raw or compressed segmentation files and writes them compressed.\n"
+              << "Options:\n"
+              << "  --raw          Write the raw format, readable by previous versions.\n"
+              << "  --level=N      zlib compression level 0-9 (default 6).\n"
+              << "  --keyframes=N  Store only changes to the previous frame, with a\n"
+              << "                 keyframe every N frames (default: every frame).\n"
+              << "  --no-verify    Do not decode the output and compare it to the input.\n";
+    return 1;
+  }
+
+  const std::string input_filename(argv[1]);
+  const std::string output_filename(argv[2]);
+  if (input_filename == output_filename) {
+    std::cerr << "Input and output have to be different files.\n";
+    return 1;
+  }
+
+  SegmentationFileFormat format = SEGMENTATION_FORMAT_COMPRESSED;
+  int compression_level = 6;
+  int keyframe_interval = 0;
+  bool verify = true;
+  for (int i = 3; i < argc; ++i) {
+    const std::string option(argv[i]);
+    if (option == "--raw") {
+      format = SEGMENTATION_FORMAT_RAW;
+    } else if (option.compare(0, 8, "--level=") == 0) {
+      compression_level = atoi(option.c_str() + 8);
+      if (compression_level < 0 || compression_level > 9) {
+        std::cerr << "Invalid compression level: " << option << "\n";
+        return 1;
+      }
+    } else if (option == "--no-verify") {
+      verify = false;
+    } else if (option.compare(0, 12, "--keyframes=") == 0) {
+      keyframe_interval = atoi(option.c_str() + 12);
+      if (keyframe_interval < 1) {
+        std::cerr << "Invalid keyframe interval: " << option << "\n";
+        return 1;
+      }
+    } else {
+      std::cerr << "Unknown option: " << option << "\n";
+      return 1;
+    }
+  }
+
+  SegmentationReader reader(input_filename);
+  if (!reader.OpenFileAndReadHeader()) {
+    return 1;
+  }
+
+  SegmentationWriter writer(output_filename, format, compression_level, keyframe_interval);
+  if (!writer.OpenAndPrepareFileHeader()) {
+    return 1;
+  }
+
+  // Frames are converted one at a time, time stamps are kept.
+  SegmentationReader::FrameBuffer frame_buffer;
+  for (int f = 0; f < reader.FrameNumber(); ++f) {
+    if (!reader.ReadFrame(f, &frame_buffer)) {
+      std::cerr << "Could not read frame " << f << " of " << input_filename << "\n";
+      return 1;
+    }
+    if (!writer.WriteSegmentation(frame_buffer.desc, reader.TimeStamps()[f])) {
+      std::cerr << "Could not write frame " << f << " to " << output_filename << "\n";
+      return 1;
+    }
+  }
+
+  if (!writer.WriteOffsetsAndClose()) {
+    return 1;
+  }
+
+  if (verify && !VerifyOutput(&reader, output_filename)) {
+    return 1;
+  }
+  reader.CloseFile();
+
+  const int64_t input_size = FileSize(input_filename);
+  const int64_t output_size = FileSize(output_filename);
+  std::cout << "Converted " << reader.FrameNumber() << " frames of " << input_filename
+            << " (" << (reader.IsCompressed() ? "compressed" : "raw") << ", "
+            << input_size << " bytes) to " << output_filename << " ("
+            << (format == SEGMENTATION_FORMAT_COMPRESSED ? "compressed" : "raw") << ", "
+            << output_size << " bytes" << (verify ? ", verified" : "") << ").\n";
+  return 0;
+}
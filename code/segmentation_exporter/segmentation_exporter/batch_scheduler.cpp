@@ -0,0 +1,190 @@
+/*
+ *  batch_scheduler.cpp
+ *  segmentation_exporter
+ *
+ */
+
+#include "batch_scheduler.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace Segment {
+
+  namespace {
+    struct WorkerArgs {
+      WorkerArgs(BatchScheduler* scheduler_, int worker_)
+          : scheduler(scheduler_), worker(worker_) {}
+
+      BatchScheduler* scheduler;
+      int worker;
+    };
+  }  // namespace.
+
+  BatchScheduler::~BatchScheduler() {
+    for (int i = 0; i < (int)jobs_.size(); ++i) {
+      delete jobs_[i];
+    }
+  }
+
+  void BatchScheduler::AddJob(ExportJob* job) {
+    jobs_.push_back(job);
+    remaining_tasks_.push_back(0);
+  }
+
+  int BatchScheduler::Run() {
+    queues_.resize(num_threads_);
+
+    vector<WorkerArgs> args;
+    for (int i = 0; i < num_threads_; ++i) {
+      args.push_back(WorkerArgs(this, i));
+    }
+
+    // Queues of workers that could not be started are emptied by stealing.
+    Thread* threads = new Thread[num_threads_];
+    int num_started = 0;
+    for (int i = 0; i < num_threads_; ++i) {
+      if (threads[i].Start(&BatchScheduler::WorkerMain, &args[i])) {
+        ++num_started;
+      }
+    }
+
+    if (num_started < num_threads_) {
+      std::cerr << "Could only start " << num_started << " of " << num_threads_
+                << " worker threads.\n";
+    }
+    if (num_started == 0) {
+      WorkerLoop(0);
+    }
+
+    // Joins all threads.
+    delete [] threads;
+    return num_failed_jobs_;
+  }
+
+  void BatchScheduler::WorkerMain(void* arg) {
+    WorkerArgs* worker_args = reinterpret_cast<WorkerArgs*>(arg);
+    worker_args->scheduler->WorkerLoop(worker_args->worker);
+  }
+
+  void BatchScheduler::WorkerLoop(int worker) {
+    ExportBuffers buffers;
+    Task task(0, 0, 0);
+    int current_job = -1;
+    while (NextTask(worker, &task)) {
+      if (task.job != current_job) {
+        // Decoded frame belongs to the previous job's file.
+        buffers.frame.Clear();
+        current_job = task.job;
+      }
+      
+      ExportJob* job = jobs_[task.job];
+      for (int frame = task.first_frame; frame <= task.last_frame; ++frame) {
+        job->ExportFrame(frame, &buffers);
+      }
+      TaskDone(task);
+    }
+  }
+
+  bool BatchScheduler::NextTask(int worker, Task* task) {
+    MutexLock lock(&mutex_);
+    while (true) {
+      // Own queue first.
+      if (!queues_[worker].empty()) {
+        *task = queues_[worker].front();
+        queues_[worker].pop_front();
+        return true;
+      }
+
+      // Steal from the end of other queues.
+      for (int i = 1; i < num_threads_; ++i) {
+        std::deque<Task>& queue = queues_[(worker + i) % num_threads_];
+        if (!queue.empty()) {
+          *task = queue.back();
+          queue.pop_back();
+          return true;
+        }
+      }
+
+      if (next_job_ < (int)jobs_.size() && num_open_jobs_ < max_open_jobs_) {
+        // Open next job without holding the lock.
+        const int job = next_job_++;
+        ++num_open_jobs_;
+
+        mutex_.Unlock();
+        const bool success = jobs_[job]->Open();
+        mutex_.Lock();
+
+        if (success) {
+          EnqueueJob(job, worker);
+        } else {
+          std::cerr << "Failed to open " << jobs_[job]->input_filename() << "\n";
+          ++num_failed_jobs_;
+          --num_open_jobs_;
+          delete jobs_[job];
+          jobs_[job] = 0;
+        }
+        state_changed_.Broadcast();
+        continue;
+      }
+
+      if (next_job_ == (int)jobs_.size() && num_open_jobs_ == 0) {
+        return false;
+      }
+
+      // Wait for new tasks or a finished job.
+      state_changed_.Wait(&mutex_);
+    }
+  }
+
+  void BatchScheduler::EnqueueJob(int job, int worker) {
+    const int num_frames = jobs_[job]->NumFrames();
+    
+    // Tasks start at keyframes, so that no frame is decoded twice.
+    int frames_per_task = frames_per_task_;
+    const int keyframe_interval = jobs_[job]->KeyframeInterval();
+    if (keyframe_interval > 0) {
+      frames_per_task = (frames_per_task + keyframe_interval - 1) / keyframe_interval *
+                        keyframe_interval;
+    }
+    
+    const int num_tasks = (num_frames + frames_per_task - 1) / frames_per_task;
+    remaining_tasks_[job] = num_tasks;
+
+    // Contiguous blocks of tasks per worker, starting with the calling worker.
+    for (int t = 0; t < num_tasks; ++t) {
+      const int block = (long long)t * num_threads_ / num_tasks;
+      const int first_frame = t * frames_per_task;
+      const int last_frame = std::min(first_frame + frames_per_task, num_frames) - 1;
+      queues_[(worker + block) % num_threads_].push_back(Task(job, first_frame, last_frame));
+    }
+  }
+
+  void BatchScheduler::TaskDone(const Task& task) {
+    {
+      MutexLock lock(&mutex_);
+      if (--remaining_tasks_[task.job] > 0)
+        return;
+    }
+
+    // Last task of the job, no other worker accesses it anymore.
+    ExportJob* job = jobs_[task.job];
+    const bool success = job->Finish();
+    if (success) {
+      std::cout << "Finished " << job->input_filename() << " (" << job->NumDuplicates()
+                << " duplicate, " << job->NumResumed() << " resumed outputs).\n" << std::flush;
+    } else {
+      std::cerr << "Failed to finish " << job->input_filename() << "\n";
+    }
+
+    MutexLock lock(&mutex_);
+    if (!success) {
+      ++num_failed_jobs_;
+    }
+    delete job;
+    jobs_[task.job] = 0;
+    --num_open_jobs_;
+    state_changed_.Broadcast();
+  }
+
+}  // namespace Segment.
@@ -0,0 +1,92 @@
+/*
+ *  batch_scheduler.h
+ *  segmentation_exporter
+ *
+ *  Parallel export of multiple segmentation files.
+ *
+ */
+
+// Runs export jobs on one pool of worker threads. Each job is split into tasks
+// of frames_per_task consecutive frames (all levels of a frame are exported
+// by the same task, so each frame is read and parsed once). For files with
+// delta frames, tasks are rounded to whole keyframe intervals. The tasks of a job
+// are distributed as contiguous blocks over per-worker queues. Workers process
+// their own queue front to back, which keeps reads sequential, and steal from
+// the back of other workers' queues when idle, so that long files do not
+// straggle behind short ones.
+//
+// Memory is bounded by opening at most max_open_jobs jobs at a time (each
+// holding a reader, the hierarchy and its dedup table) plus one set of render
+// buffers per worker. The next job is opened by a worker that runs out of
+// tasks.
+
+#ifndef BATCH_SCHEDULER_H__
+#define BATCH_SCHEDULER_H__
+
+#include <deque>
+#include <vector>
+
+#include "export_job.h"
+#include "thread_util.h"
+
+namespace Segment {
+  using std::vector;
+
+  class BatchScheduler {
+  public:
+    BatchScheduler(int num_threads, int max_open_jobs, int frames_per_task = 4)
+        : num_threads_(num_threads), max_open_jobs_(max_open_jobs),
+          frames_per_task_(frames_per_task), next_job_(0), num_open_jobs_(0),
+          num_failed_jobs_(0) {}
+    ~BatchScheduler();
+
+    // Jobs are opened and exported in the order they were added. Takes
+    // ownership of job.
+    void AddJob(ExportJob* job);
+
+    // Exports all jobs. Returns number of jobs that failed. Runs with fewer
+    // workers if threads can not be created.
+    int Run();
+
+  private:
+    struct Task {
+      Task(int job_, int first_frame_, int last_frame_)
+          : job(job_), first_frame(first_frame_), last_frame(last_frame_) {}
+
+      int job;
+      int first_frame;
+      int last_frame;
+    };
+
+    static void WorkerMain(void* arg);
+    void WorkerLoop(int worker);
+
+    // Blocks until a task is available. Returns false if all jobs are done.
+    bool NextTask(int worker, Task* task);
+
+    // Splits job into tasks and enqueues them. Called with mutex_ held.
+    void EnqueueJob(int job, int worker);
+
+    // Finishes job after its last task.
+    void TaskDone(const Task& task);
+
+  private:
+    int num_threads_;
+    int max_open_jobs_;
+    int frames_per_task_;
+
+    Mutex mutex_;
+    ConditionVariable state_changed_;
+
+    vector<ExportJob*> jobs_;
+    vector<int> remaining_tasks_;
+    vector<std::deque<Task> > queues_;
+
+    int next_job_;
+    int num_open_jobs_;
+    int num_failed_jobs_;
+  };
+
+}  // namespace Segment.
+
+#endif  // BATCH_SCHEDULER_H__
@@ -1,6 +1,8 @@
 find_package(OpenCV REQUIRED)
+find_package(ZLIB REQUIRED)
+find_package(Threads REQUIRED)
 
-set(DEPENDENT_INCLUDES ${OpenCV_INCLUDE_DIRS})
-set(DEPENDENT_LIBRARIES ${OpenCV_LIBRARIES})
+set(DEPENDENT_INCLUDES ${OpenCV_INCLUDE_DIRS} ${ZLIB_INCLUDE_DIRS})
+set(DEPENDENT_LIBRARIES ${OpenCV_LIBRARIES} ${ZLIB_LIBRARIES} ${CMAKE_THREAD_LIBS_INIT})
 set(DEPENDENT_LINK_DIRECTORIES ${OpenCV_LINK_DIRECTORIES})
 set(DEPENDENT_PACKAGES assert_log segment_util)
@@ -0,0 +1,133 @@
+/*
+ *  export_checkpoint.cpp
+ *  segmentation_exporter
+ *
+ */
+
+#include "export_checkpoint.h"
+
+#include <iostream>
+#include <sstream>
+
+#include <sys/stat.h>
+
+namespace Segment {
+
+  namespace {
+    // Returns size of file or -1 if it does not exist.
+    long long FileSize(const string& filename) {
+      struct stat file_stat;
+      if (stat(filename.c_str(), &file_stat) != 0)
+        return -1;
+      return file_stat.st_size;
+    }
+  }  // namespace.
+
+  bool ExportCheckpoint::Open(const string& signature) {
+    const string path = output_directory_ + "/" + filename_;
+    completed_.clear();
+
+    // Read previous checkpoint.
+    bool resume = false;
+    std::ifstream ifs(path.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (ifs) {
+      std::stringstream contents_stream;
+      contents_stream << ifs.rdbuf();
+      string contents = contents_stream.str();
+
+      // Drop partially written last line.
+      contents.erase(contents.find_last_of('\n') + 1);
+
+      std::istringstream lines(contents);
+      string line;
+      if (std::getline(lines, line) && line == signature) {
+        resume = true;
+        while (std::getline(lines, line)) {
+          std::istringstream line_stream(line);
+          int level, frame, num_files;
+          if (!(line_stream >> level >> frame >> num_files))
+            continue;
+
+          FileList files(num_files);
+          int k = 0;
+          for (; k < num_files; ++k) {
+            if (!(line_stream >> files[k].first >> files[k].second))
+              break;
+          }
+
+          if (k == num_files) {
+            completed_[Unit(level, frame)] = files;
+          }
+        }
+      }
+    }
+    ifs.close();
+
+    num_loaded_ = completed_.size();
+
+    if (resume) {
+      ofs_.open(path.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::app);
+    } else {
+      ofs_.open(path.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+      ofs_ << signature << "\n" << std::flush;
+    }
+
+    if (!ofs_) {
+      std::cerr << "ExportCheckpoint::Open: Could not open " << path << " to write!\n";
+      return false;
+    }
+    return true;
+  }
+
+  bool ExportCheckpoint::IsComplete(int level, int frame) const {
+    std::map<Unit, FileList>::const_iterator unit = completed_.find(Unit(level, frame));
+    if (unit == completed_.end())
+      return false;
+
+    for (FileList::const_iterator file = unit->second.begin();
+         file != unit->second.end();
+         ++file) {
+      if (FileSize(output_directory_ + "/" + file->second) != file->first)
+        return false;
+    }
+    return true;
+  }
+
+  bool ExportCheckpoint::ContainsFile(int level, int frame, const string& file) const {
+    std::map<Unit, FileList>::const_iterator unit = completed_.find(Unit(level, frame));
+    if (unit == completed_.end())
+      return false;
+
+    for (FileList::const_iterator entry = unit->second.begin();
+         entry != unit->second.end();
+         ++entry) {
+      if (entry->second == file)
+        return true;
+    }
+    return false;
+  }
+
+  bool ExportCheckpoint::MarkComplete(int level, int frame, const vector<string>& files) {
+    FileList& file_list = completed_[Unit(level, frame)];
+    file_list.clear();
+
+    std::ostringstream line;
+    line << level << " " << frame << " " << files.size();
+    for (vector<string>::const_iterator file = files.begin(); file != files.end(); ++file) {
+      const long long size = FileSize(output_directory_ + "/" + *file);
+      if (size < 0) {
+        std::cerr << "ExportCheckpoint::MarkComplete: Missing output " << *file << "\n";
+        completed_.erase(Unit(level, frame));
+        return false;
+      }
+      file_list.push_back(std::make_pair(size, *file));
+      line << " " << size << " " << *file;
+    }
+
+    // Single write per unit, flushed so it survives the process being killed.
+    line << "\n";
+    ofs_ << line.str() << std::flush;
+    return ofs_.good();
+  }
+
+}  // namespace Segment.
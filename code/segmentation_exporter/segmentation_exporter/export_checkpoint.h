@@ -0,0 +1,72 @@
+/*
+ *  export_checkpoint.h
+ *  segmentation_exporter
+ *
+ *  Resumable exports.
+ *
+ */
+
+// Records which (level, frame) outputs of an export finished, so that an
+// interrupted export can be restarted without redoing completed work.
+//
+// The checkpoint is a text file in the output directory. The first line holds
+// a signature of the export (input file and options); a checkpoint with a
+// different signature is discarded. Each following line records one
+// completed (level, frame) unit, appended and flushed after all of its files
+// were written:
+//   LEVEL FRAME NUM_FILES [FILE_SIZE RELATIVE_PATH] x NUM_FILES
+// A unit is only considered complete on restart if all of its files still
+// exist with the recorded size. A partially written last line (process killed
+// while appending) is ignored.
+
+#ifndef EXPORT_CHECKPOINT_H__
+#define EXPORT_CHECKPOINT_H__
+
+#include <fstream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Segment {
+  using std::string;
+  using std::vector;
+
+  class ExportCheckpoint {
+  public:
+    // Files are specified relative to output_directory.
+    ExportCheckpoint(const string& output_directory, const string& filename)
+        : output_directory_(output_directory), filename_(filename), num_loaded_(0) {}
+
+    // Loads the checkpoint if present and signature matches, otherwise starts a
+    // new one. Returns false if the checkpoint can not be written.
+    bool Open(const string& signature);
+
+    // Number of units loaded from a previous run.
+    int NumLoaded() const { return num_loaded_; }
+
+    // Returns true if (level, frame) was recorded as complete and all of its
+    // files are present with the recorded size.
+    bool IsComplete(int level, int frame) const;
+
+    // Returns true if file was recorded as one of the files of (level, frame).
+    bool ContainsFile(int level, int frame, const string& file) const;
+
+    // Records (level, frame) as complete with the specified files.
+    bool MarkComplete(int level, int frame, const vector<string>& files);
+
+  private:
+    typedef std::pair<int, int> Unit;
+    typedef vector<std::pair<long long, string> > FileList;
+
+    string output_directory_;
+    string filename_;
+    std::ofstream ofs_;
+
+    std::map<Unit, FileList> completed_;
+    int num_loaded_;
+  };
+
+}  // namespace Segment.
+
+#endif  // EXPORT_CHECKPOINT_H__
@@ -0,0 +1,424 @@
+/*
+ *  export_job.cpp
+ *  segmentation_exporter
+ *
+ */
+
+#include "export_job.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "segmentation_contour.h"
+
+namespace Segment {
+
+  ExportJob::ExportJob(const string& input_filename,
+                       const string& output_root,
+                       const ExportOptions& options)
+      : input_filename_(input_filename),
+        options_(options),
+        reader_(input_filename),
+        max_level_(0),
+        num_levels_(0),
+        image_writer_(options.writer_options),
+        output_(output_root, options.use_archive, options.dedup_mode),
+        checkpoint_(0),
+        num_unrecorded_(0),
+        num_duplicates_(0),
+        num_resumed_(0) {
+  }
+
+  ExportJob::~ExportJob() {
+    delete checkpoint_;
+  }
+
+  bool ExportJob::Open() {
+    if (!reader_.OpenFileAndReadHeader())
+      return false;
+
+    if (reader_.FrameNumber() == 0) {
+      std::cerr << "Segmentation file " << input_filename_ << " contains no frames.\n";
+      return false;
+    }
+
+    // First frame contains the hierarchy.
+    if (!reader_.ReadFrame(0, &hierarchy_)) {
+      std::cerr << "Could not read first frame of " << input_filename_ << "\n";
+      return false;
+    }
+
+    const int frame_width = hierarchy_.frame_width();
+    const int frame_height = hierarchy_.frame_height();
+    render_rect_ = RenderRect(0, 0, frame_width, frame_height);
+    if (options_.use_crop) {
+      // Clip crop rectangle to frame domain.
+      render_rect_ = options_.crop;
+      render_rect_.width = std::min(render_rect_.width, frame_width - render_rect_.x);
+      render_rect_.height = std::min(render_rect_.height, frame_height - render_rect_.y);
+      if (render_rect_.width <= 0 || render_rect_.height <= 0) {
+        std::cerr << "Crop rectangle is outside of the frames of " << input_filename_ << "\n";
+        return false;
+      }
+    }
+
+    max_level_ = hierarchy_.hierarchy_size();
+    num_levels_ = max_level_ + 2;
+
+    // Any change of input or options invalidates the checkpoint.
+    std::stringstream signature;
+    {
+      std::ifstream input_file(input_filename_.c_str(), std::ios_base::in | std::ios_base::binary);
+      input_file.seekg(0, std::ios_base::end);
+      signature << "segmentation_exporter checkpoint 1 " << input_filename_
+                << " " << input_file.tellg() << options_.signature;
+    }
+
+    output_.MakeDirectory("");
+
+    bool resume = false;
+    if (options_.use_checkpoint && !options_.use_archive) {
+      checkpoint_ = new ExportCheckpoint(output_.output_root(), "export_checkpoint.txt");
+      if (!checkpoint_->Open(signature.str()))
+        return false;
+      resume = checkpoint_->NumLoaded() > 0;
+    } else if (options_.use_checkpoint) {
+      // Archives are recovered from their records.
+      resume = true;
+    }
+
+    if (!output_.Open(signature.str(), resume))
+      return false;
+
+    for (int level = 0; level < num_levels_; ++level) {
+      std::stringstream directory_name;
+      directory_name << "hierarchy_level_" << std::setfill( '0' ) << std::setw( 2 ) << level;
+      output_.MakeDirectory(directory_name.str());
+
+      for (int l = 1; l <= options_.pyramid_levels; ++l) {
+        std::stringstream thumbnail_directory_name;
+        thumbnail_directory_name << directory_name.str() << "/scale_" << (options_.scale << l);
+        output_.MakeDirectory(thumbnail_directory_name.str());
+      }
+    }
+
+    std::cout << "Exporting " << input_filename_ << " (" << reader_.FrameNumber()
+              << " frames, " << frame_width << "x" << frame_height << ") to "
+              << output_.output_root() << "\n";
+    return true;
+  }
+
+  bool ExportJob::ExportFrame(int frame, ExportBuffers* buffers) {
+    bool parsed = false;
+    bool frame_success = true;
+
+    // First occurrence of the image at max_level_, used for clamped levels.
+    std::pair<int, int> max_level_source(max_level_, frame);
+
+    for (int level = 0; level < num_levels_; ++level) {
+      const bool completed = IsComplete(level, frame);
+      if (completed && (options_.dedup_mode == DEDUP_OFF || level > max_level_)) {
+        MutexLock lock(&mutex_);
+        ++num_resumed_;
+        continue;
+      }
+
+      // Files written for (level, frame), relative to the output root.
+      vector<string> written_files;
+
+      if (options_.dedup_mode != DEDUP_OFF) {
+        std::pair<int, int> source(level, frame);
+        if (level > max_level_) {
+          // Without an existing max_level_ image, clamped levels are rendered.
+          if (max_level_source.first >= 0) {
+            source = max_level_source;
+          }
+        } else {
+          // Completed frames are hashed as well, to dedup other frames against
+          // them.
+          if (!parsed) {
+            if (!ParseFrame(frame, level, buffers))
+              return false;
+            parsed = true;
+          }
+          const uint64_t hash = RenderedContentHash(render_rect_, options_.scale, level,
+                                                    buffers->frame.desc, &hierarchy_);
+
+          // Completed manifest entries of a previous run have no files and can
+          // not be sources.
+          const bool is_source = !completed || HasImageFiles(level, frame);
+          MutexLock lock(&mutex_);
+          if (is_source) {
+            source = rendered_outputs_.insert(std::make_pair(hash, source)).first->second;
+          } else {
+            std::map<uint64_t, std::pair<int, int> >::const_iterator rendered =
+                rendered_outputs_.find(hash);
+            source = rendered != rendered_outputs_.end() ? rendered->second
+                                                         : std::make_pair(-1, -1);
+          }
+          if (level == max_level_) {
+            max_level_source = source;
+          }
+        }
+
+        if (completed) {
+          MutexLock lock(&mutex_);
+          ++num_resumed_;
+          continue;
+        }
+
+        if (source != std::make_pair(level, frame)) {
+          bool success = true;
+          if (options_.write_contours) {
+            // Contours are not covered by the content hash (they ignore crop
+            // and scale), only clamped levels are duplicates.
+            const string contour_name = OutputFileName(level, 0, frame, ".contours");
+            if (level > max_level_) {
+              success = !IsFailed(max_level_, frame) &&
+                        EmitDuplicate(OutputFileName(max_level_, 0, frame, ".contours"),
+                                      contour_name, &written_files);
+            } else if (WriteContours(level, buffers->frame.desc, contour_name)) {
+              written_files.push_back(contour_name);
+            } else {
+              success = false;
+            }
+          }
+
+          if (source.second == frame) {
+            // Source was written by this call.
+            success = success && !IsFailed(source.first, frame);
+            for (int l = 0; l <= options_.pyramid_levels && success; ++l) {
+              success = EmitDuplicate(OutputFileName(source.first, l, frame,
+                                                     image_writer_.Extension()),
+                                      OutputFileName(level, l, frame, image_writer_.Extension()),
+                                      &written_files);
+            }
+
+            // Failed outputs are redone on the next run.
+            if (success) {
+              MarkComplete(level, frame, written_files);
+            } else {
+              MarkFailed(level, frame);
+              frame_success = false;
+            }
+          } else if (!success) {
+            MarkFailed(level, frame);
+            frame_success = false;
+          } else {
+            DeferredDuplicate duplicate;
+            duplicate.level = level;
+            duplicate.frame = frame;
+            duplicate.source = source;
+            duplicate.written_files = written_files;
+
+            MutexLock lock(&mutex_);
+            deferred_duplicates_.push_back(duplicate);
+          }
+          continue;
+        }
+      }
+
+      if (!parsed) {
+        if (!ParseFrame(frame, level, buffers))
+          return false;
+        parsed = true;
+      }
+
+      bool success = RenderAndWriteImages(level, frame, buffers, &written_files);
+
+      if (options_.write_contours) {
+        const string contour_name = OutputFileName(level, 0, frame, ".contours");
+        if (WriteContours(level, buffers->frame.desc, contour_name)) {
+          written_files.push_back(contour_name);
+        } else {
+          success = false;
+        }
+      }
+
+      // Failed outputs are redone on the next run.
+      if (success) {
+        MarkComplete(level, frame, written_files);
+      } else {
+        MarkFailed(level, frame);
+        frame_success = false;
+      }
+    }
+    return frame_success;
+  }
+
+  bool ExportJob::Finish() {
+    // All frames are written, sources of deferred duplicates exist.
+    for (vector<DeferredDuplicate>::iterator duplicate = deferred_duplicates_.begin();
+         duplicate != deferred_duplicates_.end();
+         ++duplicate) {
+      // Duplicates of failed sources are redone on the next run.
+      bool success = !IsFailed(duplicate->source.first, duplicate->source.second);
+      for (int l = 0; l <= options_.pyramid_levels && success; ++l) {
+        success = EmitDuplicate(OutputFileName(duplicate->source.first, l,
+                                               duplicate->source.second,
+                                               image_writer_.Extension()),
+                                OutputFileName(duplicate->level, l, duplicate->frame,
+                                               image_writer_.Extension()),
+                                &duplicate->written_files);
+      }
+
+      if (success) {
+        MarkComplete(duplicate->level, duplicate->frame, duplicate->written_files);
+      } else {
+        MarkFailed(duplicate->level, duplicate->frame);
+      }
+    }
+    deferred_duplicates_.clear();
+
+    reader_.CloseFile();
+    bool success = output_.Close();
+    if (!failed_units_.empty()) {
+      std::cerr << failed_units_.size() << " outputs of " << input_filename_
+                << " could not be written.\n";
+      success = false;
+    }
+    if (num_unrecorded_ > 0) {
+      std::cerr << num_unrecorded_ << " outputs of " << input_filename_
+                << " could not be recorded in the checkpoint.\n";
+      success = false;
+    }
+    return success;
+  }
+
+  string ExportJob::OutputFileName(int level,
+                                   int pyramid_level,
+                                   int frame,
+                                   const string& extension) const {
+    std::stringstream name_stream;
+    name_stream << "hierarchy_level_" << std::setfill( '0' ) << std::setw( 2 ) << level << "/";
+    if (pyramid_level > 0) {
+      name_stream << "scale_" << (options_.scale << pyramid_level) << "/";
+    }
+    name_stream << std::setfill( '0' ) << std::setw( 6 ) << frame + 1 << extension;
+    return name_stream.str();
+  }
+
+  bool ExportJob::ParseFrame(int frame, int first_level, ExportBuffers* buffers) {
+    if (!reader_.ReadFrame(frame, &buffers->frame)) {
+      std::cerr << "Could not read frame " << frame << " of " << input_filename_ << "\n";
+      for (int level = first_level; level < num_levels_; ++level) {
+        if (!IsComplete(level, frame)) {
+          MarkFailed(level, frame);
+        }
+      }
+      return false;
+    }
+    return true;
+  }
+
+  bool ExportJob::IsComplete(int level, int frame) {
+    if (output_.NumRecovered() > 0) {
+      // Recovered archive entries are complete by construction.
+      for (int l = 0; l <= options_.pyramid_levels; ++l) {
+        if (!output_.ContainsRecovered(OutputFileName(level, l, frame, image_writer_.Extension())))
+          return false;
+      }
+      return !options_.write_contours ||
+             output_.ContainsRecovered(OutputFileName(level, 0, frame, ".contours"));
+    }
+
+    MutexLock lock(&mutex_);
+    return checkpoint_ && checkpoint_->IsComplete(level, frame);
+  }
+
+  bool ExportJob::HasImageFiles(int level, int frame) {
+    if (output_.DuplicatesAreFiles())
+      return true;
+
+    MutexLock lock(&mutex_);
+    for (int l = 0; l <= options_.pyramid_levels; ++l) {
+      if (!checkpoint_ ||
+          !checkpoint_->ContainsFile(level, frame,
+                                     OutputFileName(level, l, frame, image_writer_.Extension())))
+        return false;
+    }
+    return true;
+  }
+
+  void ExportJob::MarkComplete(int level, int frame, const vector<string>& files) {
+    MutexLock lock(&mutex_);
+    if (checkpoint_ && !checkpoint_->MarkComplete(level, frame, files)) {
+      ++num_unrecorded_;
+    }
+  }
+
+  bool ExportJob::EmitDuplicate(const string& source,
+                                const string& dest,
+                                vector<string>* written_files) {
+    if (!output_.WriteDuplicate(source, dest)) {
+      std::cerr << "Could not write " << dest << " as duplicate of " << source << "\n";
+      return false;
+    }
+
+    if (output_.DuplicatesAreFiles()) {
+      written_files->push_back(dest);
+    }
+
+    MutexLock lock(&mutex_);
+    ++num_duplicates_;
+    return true;
+  }
+
+  void ExportJob::MarkFailed(int level, int frame) {
+    MutexLock lock(&mutex_);
+    failed_units_.insert(std::make_pair(level, frame));
+  }
+
+  bool ExportJob::IsFailed(int level, int frame) {
+    MutexLock lock(&mutex_);
+    return failed_units_.count(std::make_pair(level, frame)) > 0;
+  }
+
+  bool ExportJob::WriteContours(int level, const SegmentationDesc& desc, const string& file_name) {
+    vector<RegionContour> contours;
+    ExtractContours(level, desc, &hierarchy_, &contours);
+
+    vector<uchar> data;
+    SerializeContours(contours, &data);
+    return output_.Write(file_name, data);
+  }
+
+  bool ExportJob::RenderAndWriteImages(int level,
+                                       int frame,
+                                       ExportBuffers* buffers,
+                                       vector<string>* written_files) {
+    buffers->renderer.set_band_rows(options_.band_rows);
+    ImageBandEncoder encoder(image_writer_.options());
+    EncodingBandConsumer consumer(&encoder);
+
+    bool success = true;
+    for (int l = 0; l <= options_.pyramid_levels; ++l) {
+      const int scale = options_.scale << l;
+      const int width = ScaledSize(render_rect_.width, scale);
+      const int height = ScaledSize(render_rect_.height, scale);
+
+      // Each band is encoded right after it was rendered, while it is in cache.
+      const string file_name = OutputFileName(level, l, frame, image_writer_.Extension());
+      if (encoder.Begin(width, height, 3, &buffers->encoded) &&
+          buffers->renderer.RenderRegionsRandomColor(render_rect_,
+                                                     scale,
+                                                     level,
+                                                     true,
+                                                     buffers->frame.desc,
+                                                     &hierarchy_,
+                                                     &consumer) &&
+          encoder.Finish() &&
+          output_.Write(file_name, buffers->encoded)) {
+        written_files->push_back(file_name);
+      } else {
+        success = false;
+      }
+    }
+
+    return success;
+  }
+
+}  // namespace Segment.
@@ -0,0 +1,207 @@
+/*
+ *  export_job.h
+ *  segmentation_exporter
+ *
+ *  Export of one segmentation file.
+ *
+ */
+
+// An ExportJob renders every frame of a segmentation file at every hierarchy
+// level and writes the images (and optionally contours and thumbnails) to
+// hierarchy_level_XX/NNNNNN.ext below the output root. Frames are exported
+// independently of each other via ExportFrame, which may be called
+// concurrently for different frames of the same job (see batch_scheduler.h).
+//
+// Duplicate outputs are detected by level clamping and by
+// RenderedContentHash. Duplicates of outputs of the same frame are written
+// immediately, duplicates of other frames' outputs (which might still be in
+// progress) are deferred to Finish.
+
+#ifndef EXPORT_JOB_H__
+#define EXPORT_JOB_H__
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "export_checkpoint.h"
+#include "export_output.h"
+#include "image_writer.h"
+#include "segmentation.pb.h"
+#include "segmentation_io.h"
+#include "segmentation_util.h"
+#include "thread_util.h"
+
+namespace Segment {
+  using std::string;
+  using std::vector;
+
+  struct ExportOptions {
+    ExportOptions() : use_crop(false), scale(1), pyramid_levels(0), write_contours(false),
+                      dedup_mode(DEDUP_LINK), use_checkpoint(true), use_archive(false),
+                      band_rows(0) {}
+
+    // Only pixels within crop are rendered, crop is clipped to each file's
+    // frame size.
+    bool use_crop;
+    RenderRect crop;
+
+    // Output is rendered at 1 / scale of the resolution, with additional
+    // thumbnails at scale * 2^(i + 1), i < pyramid_levels.
+    int scale;
+    int pyramid_levels;
+
+    bool write_contours;
+    DedupMode dedup_mode;
+
+    // Completed frames are recorded and skipped when an export is restarted.
+    bool use_checkpoint;
+    bool use_archive;
+
+    ImageWriterOptions writer_options;
+
+    // Images are rendered and encoded in bands of band_rows rows, 0 selects
+    // cache sized bands (see BandRenderer).
+    int band_rows;
+
+    // Appended to the checkpoint signature, a change of signature invalidates
+    // previous checkpoints.
+    string signature;
+  };
+
+  // Passes rendered bands on to an image encoder.
+  class EncodingBandConsumer : public RenderBandConsumer {
+  public:
+    explicit EncodingBandConsumer(ImageBandEncoder* encoder) : encoder_(encoder) {}
+
+    virtual bool ConsumeBand(const char* rows, int width_step, int first_row, int num_rows) {
+      return encoder_->AddRows(reinterpret_cast<const uchar*>(rows), width_step, num_rows);
+    }
+
+  private:
+    ImageBandEncoder* encoder_;
+  };
+
+  // Per thread state, reused across frames and jobs.
+  struct ExportBuffers {
+    // Last frame read from the current job's file.
+    SegmentationReader::FrameBuffer frame;
+
+    BandRenderer renderer;
+    vector<uchar> encoded;
+  };
+
+  class ExportJob {
+  public:
+    ExportJob(const string& input_filename,
+              const string& output_root,
+              const ExportOptions& options);
+    ~ExportJob();
+
+    // Reads the hierarchy, creates output directories and loads a previous
+    // checkpoint. Returns false on error.
+    bool Open();
+
+    int NumFrames() const { return reader_.FrameNumber(); }
+
+    // Frames of files with delta frames are decoded from the last keyframe,
+    // see segmentation_io.h. 0 if every frame can be decoded independently.
+    int KeyframeInterval() const { return reader_.KeyframeInterval(); }
+
+    // Renders and writes all levels of frame. Thread-safe for different frames,
+    // buffers have to be owned by the calling thread. Returns false if any
+    // output could not be written, failures are also reported by Finish.
+    bool ExportFrame(int frame, ExportBuffers* buffers);
+
+    // Writes deferred duplicates and closes the output. Call once after all
+    // frames were exported. Returns false if any output of the job failed.
+    bool Finish();
+
+    const string& input_filename() const { return input_filename_; }
+    const string& output_root() const { return output_.output_root(); }
+    int NumDuplicates() const { return num_duplicates_; }
+    int NumResumed() const { return num_resumed_; }
+
+  private:
+    // Returns path of an output file relative to the output root. Pyramid
+    // level 0 denotes the full resolution output.
+    string OutputFileName(int level, int pyramid_level, int frame, const string& extension) const;
+
+    // Reads and parses frame into buffers->frame.desc. On failure, all
+    // outputs of frame from first_level on that are not complete are marked as
+    // failed.
+    bool ParseFrame(int frame, int first_level, ExportBuffers* buffers);
+
+    bool IsComplete(int level, int frame);
+
+    // Returns true if the images of a completed unit exist as files, i.e. it
+    // was not emitted as manifest entry by a previous run.
+    bool HasImageFiles(int level, int frame);
+
+    // Records (level, frame) in the checkpoint. Units that can not be recorded
+    // fail the job in Finish.
+    void MarkComplete(int level, int frame, const vector<string>& files);
+
+    // Emits dest as duplicate of source, created files are appended to
+    // written_files. Returns false on failure.
+    bool EmitDuplicate(const string& source, const string& dest, vector<string>* written_files);
+
+    // Units that failed to render are not used as duplicate sources.
+    void MarkFailed(int level, int frame);
+    bool IsFailed(int level, int frame);
+
+    // Writes contours of all regions at level in desc.
+    bool WriteContours(int level, const SegmentationDesc& desc, const string& file_name);
+
+    // Renders buffers->frame.desc at level and its thumbnails and writes them.
+    bool RenderAndWriteImages(int level, int frame, ExportBuffers* buffers,
+                              vector<string>* written_files);
+
+  private:
+    string input_filename_;
+    ExportOptions options_;
+
+    SegmentationReader reader_;
+    SegmentationDesc hierarchy_;
+    RenderRect render_rect_;
+
+    // The renderer clamps levels to the coarsest one, levels above max_level_
+    // are exact duplicates of it.
+    int max_level_;
+    int num_levels_;
+
+    ImageWriter image_writer_;
+    ExportOutput output_;
+
+    // Guards all members below.
+    Mutex mutex_;
+    ExportCheckpoint* checkpoint_;
+
+    // Maps rendered content hash to (level, frame) of its first occurrence that
+    // exists as image files.
+    std::map<uint64_t, std::pair<int, int> > rendered_outputs_;
+
+    // Duplicates of other frames' outputs, written by Finish.
+    struct DeferredDuplicate {
+      int level;
+      int frame;
+      std::pair<int, int> source;
+      vector<string> written_files;
+    };
+    vector<DeferredDuplicate> deferred_duplicates_;
+
+    // (level, frame) units whose outputs could not be written.
+    std::set<std::pair<int, int> > failed_units_;
+
+    // Written units that could not be recorded in the checkpoint.
+    int num_unrecorded_;
+
+    int num_duplicates_;
+    int num_resumed_;
+  };
+
+}  // namespace Segment.
+
+#endif  // EXPORT_JOB_H__
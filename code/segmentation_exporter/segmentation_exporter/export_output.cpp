@@ -0,0 +1,147 @@
+/*
+ *  export_output.cpp
+ *  segmentation_exporter
+ *
+ */
+
+#include "export_output.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <iostream>
+
+namespace Segment {
+
+  namespace {
+    // Hardlinks dest to source, falls back to copying if links are not supported.
+    bool LinkOrCopyFile(const string& source, const string& dest) {
+#ifdef _WIN32
+      if (CreateHardLinkA(dest.c_str(), source.c_str(), NULL))
+        return true;
+#else
+      unlink(dest.c_str());
+      if (link(source.c_str(), dest.c_str()) == 0)
+        return true;
+#endif
+
+      std::ifstream ifs(source.c_str(), std::ios_base::in | std::ios_base::binary);
+      std::ofstream ofs(dest.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+      if (!ifs || !ofs) {
+        std::cerr << "Could not duplicate " << source << " to " << dest << "\n";
+        return false;
+      }
+      // Inserting an empty stream buffer sets failbit, the copy is complete.
+      if (ifs.peek() != std::ifstream::traits_type::eof()) {
+        ofs << ifs.rdbuf();
+      }
+      ofs.close();
+      if (ofs.fail()) {
+        std::cerr << "Could not copy " << source << " to " << dest << "\n";
+        return false;
+      }
+      return true;
+    }
+  }  // namespace.
+
+  ExportOutput::~ExportOutput() {
+    Close();
+  }
+
+  bool ExportOutput::Open(const string& signature, bool resume) {
+    if (use_archive_) {
+      archive_ = new ArchiveWriter(output_root_);
+      return archive_->Open(signature, resume);
+    }
+
+    if (dedup_mode_ == DEDUP_MANIFEST) {
+      const string manifest_name = output_root_ + "/duplicates.txt";
+      duplicate_manifest_.open(manifest_name.c_str(),
+                               resume ? std::ios_base::out | std::ios_base::app :
+                                        std::ios_base::out | std::ios_base::trunc);
+      if (!duplicate_manifest_) {
+        std::cerr << "Could not open " << manifest_name << " to write!\n";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void ExportOutput::MakeDirectory(const string& name) {
+    if (use_archive_)
+      return;
+
+    string path = name.empty() ? output_root_ : output_root_ + "/" + name;
+#ifdef _WIN32 // works for both 32 and 64 bit
+    std::replace(path.begin(), path.end(), '/', '\\');
+#endif
+
+    string mkdir_command = "mkdir " + path;
+    system( mkdir_command.c_str() );
+  }
+
+  bool ExportOutput::Write(const string& name, const vector<uchar>& data) {
+    if (archive_) {
+      MutexLock lock(&mutex_);
+      return archive_->Add(name, data.empty() ? 0 : &data[0], data.size());
+    }
+
+    const string path = output_root_ + "/" + name;
+    std::ofstream ofs(path.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!ofs) {
+      std::cerr << "Could not open " << path << " to write!\n";
+      return false;
+    }
+    ofs.write(reinterpret_cast<const char*>(data.empty() ? 0 : &data[0]), data.size());
+
+    // Buffered data is only written on close, e.g. a full disk fails here.
+    ofs.close();
+    if (ofs.fail()) {
+      std::cerr << "Could not write " << path << "\n";
+      return false;
+    }
+    return true;
+  }
+
+  bool ExportOutput::WriteDuplicate(const string& source, const string& dest) {
+    if (archive_) {
+      MutexLock lock(&mutex_);
+      return archive_->AddReference(dest, source);
+    }
+
+    if (dedup_mode_ == DEDUP_MANIFEST) {
+      MutexLock lock(&mutex_);
+      duplicate_manifest_ << dest << " " << source << "\n" << std::flush;
+      return duplicate_manifest_.good();
+    }
+
+    return LinkOrCopyFile(output_root_ + "/" + source, output_root_ + "/" + dest);
+  }
+
+  bool ExportOutput::ContainsRecovered(const string& name) {
+    MutexLock lock(&mutex_);
+    return archive_ && archive_->Contains(name);
+  }
+
+  bool ExportOutput::Close() {
+    MutexLock lock(&mutex_);
+    bool success = true;
+    if (archive_) {
+      success = archive_->Close();
+      delete archive_;
+      archive_ = 0;
+    }
+    if (duplicate_manifest_.is_open()) {
+      duplicate_manifest_.close();
+      success = success && !duplicate_manifest_.fail();
+    }
+    return success;
+  }
+
+}  // namespace Segment.
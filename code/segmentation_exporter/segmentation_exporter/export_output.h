@@ -0,0 +1,89 @@
+/*
+ *  export_output.h
+ *  segmentation_exporter
+ *
+ *  Destination of exported files.
+ *
+ */
+
+// Exported files are addressed by names relative to the output root, e.g.
+// hierarchy_level_03/000042.png, and either written below the output root
+// directory or appended to a single archive at the output path (see
+// output_archive.h).
+
+#ifndef EXPORT_OUTPUT_H__
+#define EXPORT_OUTPUT_H__
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "output_archive.h"
+#include "thread_util.h"
+
+namespace Segment {
+  typedef unsigned char uchar;
+  using std::string;
+  using std::vector;
+
+  // Duplicate outputs (levels clamped to the coarsest level and frames with
+  // identical rendered content) are either hardlinked to the first occurrence,
+  // listed in a manifest instead of being written, or written as usual.
+  // Archives always store duplicates as references to the first occurrence.
+  enum DedupMode {
+    DEDUP_LINK,
+    DEDUP_MANIFEST,
+    DEDUP_OFF
+  };
+
+  // All methods are thread-safe.
+  class ExportOutput {
+  public:
+    ExportOutput(const string& output_root, bool use_archive, DedupMode dedup_mode)
+        : output_root_(output_root), use_archive_(use_archive), dedup_mode_(dedup_mode),
+          archive_(0) {}
+    ~ExportOutput();
+
+    // Creates the archive or, for directory outputs, opens the duplicate
+    // manifest. The output root directory has to be created beforehand by
+    // MakeDirectory(""). If resume is set, a previous archive with the same
+    // signature and the duplicate manifest are appended to instead of
+    // overwritten.
+    bool Open(const string& signature, bool resume);
+
+    // Creates directory below output root (the root itself for an empty name),
+    // no-op for archives.
+    void MakeDirectory(const string& name);
+
+    bool Write(const string& name, const vector<uchar>& data);
+
+    // Emits dest as duplicate of source. Returns false on failure.
+    bool WriteDuplicate(const string& source, const string& dest);
+
+    // Returns true if duplicates are created as files or archive entries,
+    // false if they are only listed in the manifest.
+    bool DuplicatesAreFiles() const { return use_archive_ || dedup_mode_ != DEDUP_MANIFEST; }
+
+    // Entries recovered from a previous archive.
+    int NumRecovered() const { return archive_ ? archive_->NumRecovered() : 0; }
+    bool ContainsRecovered(const string& name);
+
+    // Writes archive index.
+    bool Close();
+
+    bool IsArchive() const { return use_archive_; }
+    const string& output_root() const { return output_root_; }
+
+  private:
+    string output_root_;
+    bool use_archive_;
+    DedupMode dedup_mode_;
+
+    Mutex mutex_;
+    ArchiveWriter* archive_;
+    std::ofstream duplicate_manifest_;
+  };
+
+}  // namespace Segment.
+
+#endif  // EXPORT_OUTPUT_H__
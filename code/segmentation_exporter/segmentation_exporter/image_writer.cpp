@@ -0,0 +1,497 @@
+/*
+ *  image_writer.cpp
+ *  segmentation_exporter
+ *
+ */
+
+#include "image_writer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace Segment {
+
+  namespace {
+    void AppendBigEndian32(unsigned int value, vector<uchar>* buffer) {
+      buffer->push_back((value >> 24) & 0xff);
+      buffer->push_back((value >> 16) & 0xff);
+      buffer->push_back((value >> 8) & 0xff);
+      buffer->push_back(value & 0xff);
+    }
+
+    void AppendLittleEndian16(unsigned int value, vector<uchar>* buffer) {
+      buffer->push_back(value & 0xff);
+      buffer->push_back((value >> 8) & 0xff);
+    }
+
+    void AppendLittleEndian32(unsigned int value, vector<uchar>* buffer) {
+      AppendLittleEndian16(value & 0xffff, buffer);
+      AppendLittleEndian16(value >> 16, buffer);
+    }
+
+    // Appends PNG chunk of type with data, including length and crc.
+    void AppendPNGChunk(const char* type, const uchar* data, int sz, vector<uchar>* buffer) {
+      AppendBigEndian32(sz, buffer);
+      const int type_pos = buffer->size();
+      buffer->insert(buffer->end(), type, type + 4);
+      if (sz > 0)
+        buffer->insert(buffer->end(), data, data + sz);
+      const uLong crc = crc32(0L, &(*buffer)[type_pos], sz + 4);
+      AppendBigEndian32(crc, buffer);
+    }
+
+    // Size of the palette hash table, a power of two.
+    const int kPaletteTableSize = 1024;
+
+    // Minimum free space of the output buffer passed to deflate.
+    const int kMinDeflateSpace = 16 * 1024;
+  }  // namespace.
+
+  bool ParseImageFormat(const string& name, ImageFormat* format) {
+    if (name == "png")
+      *format = IMAGE_FORMAT_PNG;
+    else if (name == "ppm")
+      *format = IMAGE_FORMAT_PPM;
+    else if (name == "bmp")
+      *format = IMAGE_FORMAT_BMP;
+    else if (name == "raw")
+      *format = IMAGE_FORMAT_RAW;
+    else
+      return false;
+    return true;
+  }
+
+  bool ParseCompressionStrategy(const string& name, int* strategy) {
+    if (name == "default")
+      *strategy = Z_DEFAULT_STRATEGY;
+    else if (name == "filtered")
+      *strategy = Z_FILTERED;
+    else if (name == "huffman")
+      *strategy = Z_HUFFMAN_ONLY;
+    else if (name == "rle")
+      *strategy = Z_RLE;
+    else if (name == "fixed")
+      *strategy = Z_FIXED;
+    else
+      return false;
+    return true;
+  }
+
+  const char* ImageWriter::Extension() const {
+    switch (options_.format) {
+      case IMAGE_FORMAT_PPM:
+        return ".ppm";
+      case IMAGE_FORMAT_BMP:
+        return ".bmp";
+      case IMAGE_FORMAT_RAW:
+        return ".raw";
+      default:
+        return ".png";
+    }
+  }
+
+  bool ImageWriter::Encode(const uchar* img,
+                           int width_step,
+                           int width,
+                           int height,
+                           int num_channels,
+                           vector<uchar>* buffer) const {
+    ImageBandEncoder encoder(options_);
+    return encoder.Begin(width, height, num_channels, buffer) &&
+           encoder.AddRows(img, width_step, height) &&
+           encoder.Finish();
+  }
+
+  bool ImageWriter::WriteImage(const string& filename,
+                               const uchar* img,
+                               int width_step,
+                               int width,
+                               int height,
+                               int num_channels) const {
+    vector<uchar> buffer;
+    if (!Encode(img, width_step, width, height, num_channels, &buffer))
+      return false;
+
+    std::ofstream ofs(filename.c_str(),
+                      std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!ofs) {
+      std::cerr << "ImageWriter::WriteImage: "
+                << "Could not open " << filename << " to write!\n";
+      return false;
+    }
+
+    ofs.write(reinterpret_cast<const char*>(&buffer[0]), buffer.size());
+    return ofs.good();
+  }
+
+  ImageBandEncoder::ImageBandEncoder(const ImageWriterOptions& options)
+      : options_(options),
+        width_(0),
+        height_(0),
+        num_channels_(0),
+        rows_added_(0),
+        buffer_(0),
+        stream_active_(false),
+        color_type_(0) {
+    memset(&stream_, 0, sizeof(stream_));
+  }
+
+  ImageBandEncoder::~ImageBandEncoder() {
+    EndDeflate();
+  }
+
+  bool ImageBandEncoder::Begin(int width, int height, int num_channels, vector<uchar>* buffer) {
+    EndDeflate();
+    buffer_ = 0;
+    if (num_channels != 1 && num_channels != 3) {
+      std::cerr << "ImageBandEncoder::Begin: Only 1 and 3 channel images are supported.\n";
+      return false;
+    }
+
+    width_ = width;
+    height_ = height;
+    num_channels_ = num_channels;
+    rows_added_ = 0;
+    buffer_ = buffer;
+    buffer_->clear();
+
+    const int row_bytes = width * num_channels;
+    switch (options_.format) {
+      case IMAGE_FORMAT_PNG: {
+        if (num_channels == 1) {
+          color_type_ = 0;
+        } else if (options_.use_palette) {
+          color_type_ = 3;
+          palette_.clear();
+          palette_keys_.assign(kPaletteTableSize, 0);
+          palette_values_.resize(kPaletteTableSize);
+        } else {
+          color_type_ = 2;
+        }
+
+        if (deflateInit2(&stream_, options_.compression_level, Z_DEFLATED, 15, 8,
+                         options_.compression_strategy) != Z_OK) {
+          std::cerr << "ImageBandEncoder::Begin: Could not initialize zlib.\n";
+          return false;
+        }
+        stream_active_ = true;
+        idat_.clear();
+        return true;
+      }
+
+      case IMAGE_FORMAT_PPM: {
+        std::ostringstream header;
+        header << (num_channels == 1 ? "P5" : "P6") << "\n" << width << " " << height << "\n255\n";
+        const string header_str = header.str();
+        buffer_->reserve(header_str.size() + row_bytes * height);
+        buffer_->insert(buffer_->end(), header_str.begin(), header_str.end());
+        return true;
+      }
+
+      case IMAGE_FORMAT_BMP: {
+        // Rows are stored bottom-up and padded to 4 bytes.
+        const int padded_row_bytes = (row_bytes + 3) & ~3;
+        const int palette_sz = num_channels == 1 ? 256 * 4 : 0;
+        const int data_offset = 14 + 40 + palette_sz;
+        const int file_sz = data_offset + padded_row_bytes * height;
+
+        buffer_->reserve(file_sz);
+
+        // File header.
+        buffer_->push_back('B');
+        buffer_->push_back('M');
+        AppendLittleEndian32(file_sz, buffer_);
+        AppendLittleEndian32(0, buffer_);
+        AppendLittleEndian32(data_offset, buffer_);
+
+        // Info header.
+        AppendLittleEndian32(40, buffer_);
+        AppendLittleEndian32(width, buffer_);
+        AppendLittleEndian32(height, buffer_);
+        AppendLittleEndian16(1, buffer_);
+        AppendLittleEndian16(num_channels * 8, buffer_);
+        AppendLittleEndian32(0, buffer_);
+        AppendLittleEndian32(padded_row_bytes * height, buffer_);
+        AppendLittleEndian32(2835, buffer_);
+        AppendLittleEndian32(2835, buffer_);
+        AppendLittleEndian32(num_channels == 1 ? 256 : 0, buffer_);
+        AppendLittleEndian32(0, buffer_);
+
+        // Gray palette.
+        for (int i = 0; i < palette_sz / 4; ++i) {
+          buffer_->push_back(i);
+          buffer_->push_back(i);
+          buffer_->push_back(i);
+          buffer_->push_back(0);
+        }
+
+        buffer_->resize(file_sz, 0);
+        return true;
+      }
+
+      case IMAGE_FORMAT_RAW:
+        buffer_->reserve(row_bytes * height);
+        return true;
+    }
+    return false;
+  }
+
+  bool ImageBandEncoder::AddRows(const uchar* rows, int width_step, int num_rows) {
+    if (!buffer_ || rows_added_ + num_rows > height_) {
+      std::cerr << "ImageBandEncoder::AddRows: More rows than the image height.\n";
+      return false;
+    }
+
+    const int row_bytes = width_ * num_channels_;
+    switch (options_.format) {
+      case IMAGE_FORMAT_PNG:
+        if (!AddPNGRows(rows, width_step, num_rows))
+          return false;
+        break;
+
+      case IMAGE_FORMAT_PPM:
+        for (int i = 0; i < num_rows; ++i) {
+          const uchar* src_ptr = rows + i * width_step;
+          if (num_channels_ == 1) {
+            buffer_->insert(buffer_->end(), src_ptr, src_ptr + row_bytes);
+          } else {
+            // BGR to RGB.
+            const int row_start = buffer_->size();
+            buffer_->resize(row_start + row_bytes);
+            uchar* dst_ptr = &(*buffer_)[row_start];
+            for (int j = 0; j < width_; ++j, src_ptr += 3, dst_ptr += 3) {
+              dst_ptr[0] = src_ptr[2];
+              dst_ptr[1] = src_ptr[1];
+              dst_ptr[2] = src_ptr[0];
+            }
+          }
+        }
+        break;
+
+      case IMAGE_FORMAT_BMP: {
+        const int padded_row_bytes = (row_bytes + 3) & ~3;
+        const int data_offset = 14 + 40 + (num_channels_ == 1 ? 256 * 4 : 0);
+        for (int i = 0; i < num_rows; ++i) {
+          const int row = rows_added_ + i;
+          memcpy(&(*buffer_)[data_offset + (height_ - 1 - row) * padded_row_bytes],
+                 rows + i * width_step, row_bytes);
+        }
+        break;
+      }
+
+      case IMAGE_FORMAT_RAW:
+        for (int i = 0; i < num_rows; ++i) {
+          const uchar* src_ptr = rows + i * width_step;
+          buffer_->insert(buffer_->end(), src_ptr, src_ptr + row_bytes);
+        }
+        break;
+    }
+
+    rows_added_ += num_rows;
+    return true;
+  }
+
+  bool ImageBandEncoder::Finish() {
+    if (!buffer_ || rows_added_ != height_) {
+      std::cerr << "ImageBandEncoder::Finish: Image is incomplete.\n";
+      return false;
+    }
+
+    if (options_.format != IMAGE_FORMAT_PNG)
+      return true;
+
+    if (!Deflate(0, 0, Z_FINISH))
+      return false;
+    const int idat_sz = stream_.total_out;
+    EndDeflate();
+
+    // Assemble file.
+    const uchar signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    buffer_->reserve(idat_sz + palette_.size() + 128);
+    buffer_->insert(buffer_->end(), signature, signature + 8);
+
+    vector<uchar> header;
+    AppendBigEndian32(width_, &header);
+    AppendBigEndian32(height_, &header);
+    header.push_back(8);            // Bit depth.
+    header.push_back(color_type_);
+    header.push_back(0);            // Compression.
+    header.push_back(0);            // Filter.
+    header.push_back(0);            // Interlace.
+    AppendPNGChunk("IHDR", &header[0], header.size(), buffer_);
+
+    if (color_type_ == 3)
+      AppendPNGChunk("PLTE", &palette_[0], palette_.size(), buffer_);
+
+    AppendPNGChunk("IDAT", &idat_[0], idat_sz, buffer_);
+    AppendPNGChunk("IEND", 0, 0, buffer_);
+    return true;
+  }
+
+  bool ImageBandEncoder::AddPNGRows(const uchar* rows, int width_step, int num_rows) {
+    // Filtered rows (filter type none) are deflated band by band.
+    if (color_type_ == 3) {
+      if (MapToPalette(rows, width_step, num_rows))
+        return Deflate(&filtered_[0], filtered_.size(), Z_NO_FLUSH);
+
+      if (!SwitchToRGB())
+        return false;
+    }
+
+    const int bytes_per_pixel = color_type_ == 0 ? 1 : 3;
+    const int row_bytes = width_ * bytes_per_pixel + 1;
+    filtered_.resize(row_bytes * num_rows);
+    for (int i = 0; i < num_rows; ++i) {
+      uchar* dst_ptr = &filtered_[i * row_bytes];
+      *dst_ptr++ = 0;
+      if (color_type_ == 0) {
+        memcpy(dst_ptr, rows + i * width_step, width_);
+      } else {
+        // BGR to RGB.
+        const uchar* src_ptr = rows + i * width_step;
+        for (int j = 0; j < width_; ++j, src_ptr += 3, dst_ptr += 3) {
+          dst_ptr[0] = src_ptr[2];
+          dst_ptr[1] = src_ptr[1];
+          dst_ptr[2] = src_ptr[0];
+        }
+      }
+    }
+
+    return Deflate(&filtered_[0], filtered_.size(), Z_NO_FLUSH);
+  }
+
+  bool ImageBandEncoder::MapToPalette(const uchar* rows, int width_step, int num_rows) {
+    const int row_bytes = width_ + 1;
+    filtered_.resize(row_bytes * num_rows);
+
+    unsigned int last_key = 0;
+    uchar last_index = 0;
+    for (int i = 0; i < num_rows; ++i) {
+      const uchar* src_ptr = rows + i * width_step;
+      uchar* index_ptr = &filtered_[i * row_bytes];
+      *index_ptr++ = 0;
+      for (int j = 0; j < width_; ++j, src_ptr += 3, ++index_ptr) {
+        const unsigned int key =
+            ((unsigned int)src_ptr[0] | (src_ptr[1] << 8) | (src_ptr[2] << 16)) + 1;
+
+        // Consecutive pixels mostly belong to the same region.
+        if (key == last_key) {
+          *index_ptr = last_index;
+          continue;
+        }
+
+        int slot = (key * 2654435761u) >> 22;
+        while (palette_keys_[slot] != 0 && palette_keys_[slot] != key)
+          slot = (slot + 1) & (kPaletteTableSize - 1);
+
+        if (palette_keys_[slot] == 0) {
+          const int num_colors = palette_.size() / 3;
+          if (num_colors == 256)
+            return false;
+
+          palette_keys_[slot] = key;
+          palette_values_[slot] = num_colors;
+          palette_.push_back(src_ptr[2]);
+          palette_.push_back(src_ptr[1]);
+          palette_.push_back(src_ptr[0]);
+        }
+
+        last_key = key;
+        last_index = palette_values_[slot];
+        *index_ptr = last_index;
+      }
+    }
+
+    return true;
+  }
+
+  bool ImageBandEncoder::SwitchToRGB() {
+    color_type_ = 2;
+    if (rows_added_ == 0) {
+      // Nothing encoded yet, typical for fine levels with many colors.
+      deflateReset(&stream_);
+      return true;
+    }
+
+    // Complete the index stream and decode it row by row.
+    if (!Deflate(0, 0, Z_FINISH))
+      return false;
+
+    vector<uchar> index_data(idat_.begin(), idat_.begin() + stream_.total_out);
+    deflateReset(&stream_);
+
+    z_stream inflate_stream;
+    memset(&inflate_stream, 0, sizeof(inflate_stream));
+    if (inflateInit(&inflate_stream) != Z_OK) {
+      std::cerr << "ImageBandEncoder::SwitchToRGB: Could not initialize zlib.\n";
+      return false;
+    }
+
+    inflate_stream.next_in = &index_data[0];
+    inflate_stream.avail_in = index_data.size();
+
+    const int index_row_bytes = width_ + 1;
+    const int rgb_row_bytes = width_ * 3 + 1;
+    vector<uchar> index_row(index_row_bytes);
+    vector<uchar> rgb_row(rgb_row_bytes);
+    bool success = true;
+    for (int i = 0; i < rows_added_ && success; ++i) {
+      inflate_stream.next_out = &index_row[0];
+      inflate_stream.avail_out = index_row_bytes;
+      const int result = inflate(&inflate_stream, Z_SYNC_FLUSH);
+      if ((result != Z_OK && result != Z_STREAM_END) || inflate_stream.avail_out != 0) {
+        std::cerr << "ImageBandEncoder::SwitchToRGB: Could not decode palette rows.\n";
+        success = false;
+        break;
+      }
+
+      uchar* dst_ptr = &rgb_row[0];
+      *dst_ptr++ = 0;
+      for (int j = 1; j < index_row_bytes; ++j, dst_ptr += 3) {
+        memcpy(dst_ptr, &palette_[index_row[j] * 3], 3);
+      }
+      success = Deflate(&rgb_row[0], rgb_row_bytes, Z_NO_FLUSH);
+    }
+
+    inflateEnd(&inflate_stream);
+    return success;
+  }
+
+  bool ImageBandEncoder::Deflate(const uchar* data, int sz, int flush) {
+    stream_.next_in = const_cast<uchar*>(data);
+    stream_.avail_in = sz;
+    while (true) {
+      // Output is appended to idat_ directly, grow as needed.
+      if ((int)(idat_.size() - stream_.total_out) < kMinDeflateSpace) {
+        idat_.resize(std::max<size_t>(idat_.size() * 2, 4 * kMinDeflateSpace));
+      }
+      stream_.next_out = &idat_[stream_.total_out];
+      stream_.avail_out = idat_.size() - stream_.total_out;
+
+      const int result = deflate(&stream_, flush);
+      if (result == Z_STREAM_END)
+        return true;
+
+      if (result != Z_OK && result != Z_BUF_ERROR) {
+        std::cerr << "ImageBandEncoder::Deflate: Compression failed.\n";
+        return false;
+      }
+
+      // Done if all input was consumed without filling the output.
+      if (flush != Z_FINISH && stream_.avail_in == 0 && stream_.avail_out > 0)
+        return true;
+    }
+  }
+
+  void ImageBandEncoder::EndDeflate() {
+    if (stream_active_) {
+      deflateEnd(&stream_);
+      memset(&stream_, 0, sizeof(stream_));
+      stream_active_ = false;
+    }
+  }
+
+}  // namespace Segment.
@@ -0,0 +1,153 @@
+/*
+ *  image_writer.h
+ *  segmentation_exporter
+ *
+ *  Image encoders for exported frames.
+ *
+ */
+
+// Encodes 8-bit images with 1 (gray) or 3 (BGR, as used by OpenCV) channels
+// without going through OpenCV, to allow each site to pick its own
+// throughput / size tradeoff:
+// - PNG with settable zlib level and strategy. Images with at most 256
+//   distinct colors, as is typical for coarse hierarchy levels, are written as
+//   8-bit indexed PNG, which is several times smaller and faster to encode.
+// - Uncompressed binary PPM (P6 / P5), BMP and raw pixel data. Raw images
+//   contain the rows without padding and channels in BGR order.
+//
+// ImageBandEncoder accepts the image in bands of rows, so that rows can be
+// encoded right after they were rendered (see BandRenderer in
+// segmentation_util.h). ImageWriter encodes the whole image as one band.
+
+#ifndef IMAGE_WRITER_H__
+#define IMAGE_WRITER_H__
+
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+namespace Segment {
+  typedef unsigned char uchar;
+  using std::string;
+  using std::vector;
+
+  enum ImageFormat {
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_PPM,
+    IMAGE_FORMAT_BMP,
+    IMAGE_FORMAT_RAW
+  };
+
+  struct ImageWriterOptions {
+    ImageWriterOptions() : format(IMAGE_FORMAT_PNG), compression_level(3),
+                           compression_strategy(0), use_palette(true) {}
+
+    ImageFormat format;
+
+    // PNG only. zlib compression level in [0, 9] and strategy (Z_DEFAULT_STRATEGY,
+    // Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE or Z_FIXED).
+    int compression_level;
+    int compression_strategy;
+
+    // PNG only. Use an indexed PNG if the image contains at most 256 colors.
+    bool use_palette;
+  };
+
+  // Parses format and strategy names as passed on the command line, e.g. "bmp"
+  // or "rle". Return false on unknown names.
+  bool ParseImageFormat(const string& name, ImageFormat* format);
+  bool ParseCompressionStrategy(const string& name, int* strategy);
+
+  class ImageWriter {
+  public:
+    ImageWriter(const ImageWriterOptions& options = ImageWriterOptions())
+        : options_(options) {}
+
+    // Encodes image with num_channels (1 or 3) into buffer.
+    bool Encode(const uchar* img,
+                int width_step,
+                int width,
+                int height,
+                int num_channels,
+                vector<uchar>* buffer) const;
+
+    // Encodes image and writes it to filename.
+    bool WriteImage(const string& filename,
+                    const uchar* img,
+                    int width_step,
+                    int width,
+                    int height,
+                    int num_channels) const;
+
+    // File extension including the dot, e.g. ".png".
+    const char* Extension() const;
+
+    const ImageWriterOptions& options() const { return options_; }
+
+  private:
+    ImageWriterOptions options_;
+  };
+
+  // Encodes an image passed in bands of rows from top to bottom, with the same
+  // result as ImageWriter::Encode. Apart from the encoded output, memory use
+  // does not depend on the image height.
+  class ImageBandEncoder {
+  public:
+    explicit ImageBandEncoder(const ImageWriterOptions& options = ImageWriterOptions());
+    ~ImageBandEncoder();
+
+    // Starts encoding an image with num_channels (1 or 3) into buffer. Aborts
+    // a previous unfinished image.
+    bool Begin(int width, int height, int num_channels, vector<uchar>* buffer);
+
+    // Encodes the next num_rows rows of the image.
+    bool AddRows(const uchar* rows, int width_step, int num_rows);
+
+    // Completes the image after all rows were added.
+    bool Finish();
+
+  private:
+    ImageBandEncoder(const ImageBandEncoder&);
+    ImageBandEncoder& operator=(const ImageBandEncoder&);
+
+    bool AddPNGRows(const uchar* rows, int width_step, int num_rows);
+
+    // Maps rows to palette indices in filtered_. Returns false if the image
+    // has more than 256 colors.
+    bool MapToPalette(const uchar* rows, int width_step, int num_rows);
+
+    // Re-encodes the rows added so far as RGB, after the palette overflowed.
+    bool SwitchToRGB();
+
+    // Compresses sz bytes of data and appends the output to idat_.
+    bool Deflate(const uchar* data, int sz, int flush);
+
+    void EndDeflate();
+
+    ImageWriterOptions options_;
+    int width_;
+    int height_;
+    int num_channels_;
+    int rows_added_;
+    vector<uchar>* buffer_;
+
+    // PNG only.
+    z_stream stream_;
+    bool stream_active_;
+    int color_type_;
+
+    // Filtered rows of the current band and compressed image data.
+    vector<uchar> filtered_;
+    vector<uchar> idat_;
+
+    // Palette (RGB triples) of the rows added so far, while color_type_ is 3.
+    // Open addressing hash table from colors + 1 (0 denotes empty) to index.
+    vector<uchar> palette_;
+    vector<unsigned int> palette_keys_;
+    vector<uchar> palette_values_;
+  };
+
+}  // namespace Segment.
+
+#endif  // IMAGE_WRITER_H__
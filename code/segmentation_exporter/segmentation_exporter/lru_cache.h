@@ -0,0 +1,96 @@
+/*
+ *  lru_cache.h
+ *  segmentation_exporter
+ *
+ *  Least recently used cache.
+ *
+ */
+
+#ifndef LRU_CACHE_H__
+#define LRU_CACHE_H__
+
+#include <list>
+#include <map>
+#ifdef __linux
+  #include <stdint.h>
+#endif
+
+namespace Segment {
+
+  // Maps Key to Value, evicting the least recently used entries once the
+  // total cost of all entries exceeds capacity. Costs are arbitrary units,
+  // e.g. bytes or 1 per entry. Values are constructed in place by Insert, so
+  // that large values can be filled by swapping instead of copying.
+  // Not thread-safe.
+  template <class Key, class Value>
+  class LRUCache {
+  public:
+    explicit LRUCache(int64_t capacity) : capacity_(capacity), total_cost_(0) {}
+
+    // Returns the value for key and marks it as most recently used, 0 if key is
+    // not cached. The pointer is valid until the next call to Insert.
+    Value* Find(const Key& key) {
+      typename EntryMap::iterator entry = entries_.find(key);
+      if (entry == entries_.end())
+        return 0;
+
+      // Move to front.
+      lru_list_.splice(lru_list_.begin(), lru_list_, entry->second);
+      return &entry->second->value;
+    }
+
+    // Inserts a default constructed value for key, replacing a previous one,
+    // and returns it to be filled by the caller. Evicts least recently used
+    // entries until the total cost fits into capacity, the new entry is always
+    // kept. The pointer is valid until the next call to Insert.
+    Value* Insert(const Key& key, int64_t cost) {
+      Erase(key);
+
+      lru_list_.push_front(Entry(key, cost));
+      entries_[key] = lru_list_.begin();
+      total_cost_ += cost;
+
+      while (total_cost_ > capacity_ && lru_list_.size() > 1) {
+        Erase(lru_list_.back().key);
+      }
+
+      return &lru_list_.front().value;
+    }
+
+    void Erase(const Key& key) {
+      typename EntryMap::iterator entry = entries_.find(key);
+      if (entry == entries_.end())
+        return;
+
+      total_cost_ -= entry->second->cost;
+      lru_list_.erase(entry->second);
+      entries_.erase(entry);
+    }
+
+    int Size() const { return entries_.size(); }
+    int64_t TotalCost() const { return total_cost_; }
+    int64_t Capacity() const { return capacity_; }
+
+  private:
+    struct Entry {
+      Entry(const Key& key_, int64_t cost_) : key(key_), cost(cost_) {}
+
+      Key key;
+      int64_t cost;
+      Value value;
+    };
+
+    typedef std::list<Entry> EntryList;
+    typedef std::map<Key, typename EntryList::iterator> EntryMap;
+
+    int64_t capacity_;
+    int64_t total_cost_;
+
+    // Most recently used entry first.
+    EntryList lru_list_;
+    EntryMap entries_;
+  };
+
+}  // namespace Segment.
+
+#endif  // LRU_CACHE_H__
@@ -7,9 +7,13 @@
  *
  */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <algorithm>
+#include <fstream>
+#include <set>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -18,15 +22,21 @@
 #include <highgui.h>
 
 #include "assert_log.h"
+#include "batch_scheduler.h"
+#include "export_job.h"
+#include "export_output.h"
+#include "image_writer.h"
+#include "output_archive.h"
+#include "render_server.h"
+#include "segmentation_graph.h"
+#include "segmentation_index.h"
 #include "segmentation_io.h"
+#include "segmentation_stats.h"
 #include "segmentation_util.h"
+#include "thread_util.h"
 
 using namespace Segment;
 
-// Slider positions.
-int g_hierarchy_level;
-int g_frame_pos;
-
 // Frame width and height.
 //int g_frame_num_;
 int g_frame_width;
@@ -36,38 +46,196 @@ int g_frame_height;
 SegmentationReader* g_segment_reader;
 SegmentationDesc* g_seg_hierarchy;
 
-// Render target.
-IplImage* g_frame_buffer = 0;
+// Rendered part of the frame, either the whole frame or the crop rectangle.
+RenderRect g_render_rect;
+
+// Optional per-region statistics table, written as CSV if the filename ends
+// in .csv, as binary table otherwise.
+std::string g_stats_filename;
+bool g_stats_only = false;
+
+// Region adjacency graph file.
+std::string g_graph_filename;
+
+// Region index file, loaded if present, otherwise built and saved.
+std::string g_index_filename;
+
+// If set, only masks of g_mask_region_ids at g_mask_level are exported for
+// the frames that contain them.
+bool g_export_mask = false;
+int g_mask_level = 0;
+vector<int> g_mask_region_ids;
 
 // Indicates if automatic playing is set.
 //bool g_playing;
 
-// Returns number of hierarchy_levels.
-void RenderCurrentFrame(int frame_number) {
-  g_segment_reader->SeekToFrame(frame_number);
+// Exports masks of g_mask_region_ids for all frames in which they are present.
+// Returns false if any mask could not be exported.
+bool ExportMasks(const RegionFrameIndex& index,
+                 const ImageWriter& image_writer,
+                 ExportOutput* output) {
+  vector<int> frames;
+  index.FramesForRegions(g_mask_level, g_mask_region_ids, &frames);
+  std::cout << "Regions are present in " << frames.size() << " of "
+            << index.NumFrames() << " frames.\n";
+  
+  std::stringstream directory_name_stream;
+  directory_name_stream << "mask_level_" << std::setfill( '0' ) << std::setw( 2 ) << g_mask_level;
+  std::string directory_name = directory_name_stream.str();
+  output->MakeDirectory(directory_name);
+  
+  IplImage* mask_buffer = cvCreateImage(cvSize(g_render_rect.width,
+                                               g_render_rect.height), IPL_DEPTH_8U, 1);
+  SegmentationReader::FrameBuffer frame_buffer;
+  vector<Segment::uchar> encoded;
+  bool success = true;
+  for (int i = 0; i < (int)frames.size(); ++i) {
+    // Only frames containing the regions are read.
+    if (!g_segment_reader->ReadFrame(frames[i], &frame_buffer)) {
+      std::cerr << "Could not read frame " << frames[i] << ", skipping its mask.\n";
+      success = false;
+      continue;
+    }
+    const SegmentationDesc& segmentation = frame_buffer.desc;
+    
+    memset(mask_buffer->imageData, 0, mask_buffer->widthStep * mask_buffer->height);
+    RenderRegionsROI(g_mask_region_ids,
+                     255,
+                     reinterpret_cast<Segment::uchar*>(mask_buffer->imageData),
+                     mask_buffer->widthStep,
+                     g_render_rect,
+                     1,
+                     g_mask_level,
+                     segmentation,
+                     g_seg_hierarchy);
+    
+    std::stringstream file_name_stream;
+    file_name_stream << directory_name << "/" << std::setfill( '0' ) << std::setw( 6 ) << frames[i] + 1 << image_writer.Extension();
+    std::string file_name = file_name_stream.str();
+    
+    std::cout << file_name << std::endl;
+    if (!image_writer.Encode(reinterpret_cast<const Segment::uchar*>(mask_buffer->imageData),
+                             mask_buffer->widthStep,
+                             mask_buffer->width,
+                             mask_buffer->height,
+                             1,
+                             &encoded) ||
+        !output->Write(file_name, encoded)) {
+      success = false;
+    }
+  }
+  
+  cvReleaseImage(&mask_buffer);
+  return success;
+}
+
+// Prints name and size of every entry of an archive written with --archive.
+bool ListArchive(const std::string& archive_filename) {
+  ArchiveReader reader(archive_filename);
+  if (!reader.Open()) {
+    return false;
+  }
+  
+  typedef std::map<std::string, std::pair<int64_t, int64_t> > EntryMap;
+  for (EntryMap::const_iterator entry = reader.Entries().begin();
+       entry != reader.Entries().end();
+       ++entry) {
+    std::cout << entry->first << " " << entry->second.second << "\n";
+  }
+  return true;
+}
+
+// Returns true if name is a relative path the exporter could have written.
+// Directories are created through the shell, so names are restricted to
+// plain characters.
+bool IsSafeEntryName(const std::string& name) {
+  if (name.empty() || name[0] == '/' || name.find("..") != std::string::npos)
+    return false;
+  for (std::string::const_iterator c = name.begin(); c != name.end(); ++c) {
+    if (!isalnum((unsigned char)*c) && *c != '_' && *c != '-' && *c != '.' && *c != '/')
+      return false;
+  }
+  return true;
+}
+
+// Extracts all entries of an archive written with --archive below
+// output_root, recreating the directory tree of a regular export. Duplicates
+// are written as separate files.
+bool ExtractArchive(const std::string& archive_filename, const std::string& output_root) {
+  ArchiveReader reader(archive_filename);
+  if (!reader.Open()) {
+    return false;
+  }
   
-  // Read from file.
-  vector<Segment::uchar> data_buffer(g_segment_reader->ReadFrameSize());
-  g_segment_reader->ReadFrame(&data_buffer[0]);
+  ExportOutput output(output_root, false, DEDUP_OFF);
+  output.MakeDirectory("");
   
-  SegmentationDesc segmentation;
-  segmentation.ParseFromArray(&data_buffer[0], data_buffer.size());
+  std::set<std::string> directories;
+  vector<uchar> data;
+  int num_extracted = 0;
+  bool success = true;
+  typedef std::map<std::string, std::pair<int64_t, int64_t> > EntryMap;
+  for (EntryMap::const_iterator entry = reader.Entries().begin();
+       entry != reader.Entries().end();
+       ++entry) {
+    const std::string& name = entry->first;
+    if (!IsSafeEntryName(name)) {
+      std::cerr << "Skipping archive entry with invalid name " << name << "\n";
+      success = false;
+      continue;
+    }
+    
+    // Parent directories first, mkdir does not create intermediate ones.
+    for (size_t pos = name.find('/'); pos != std::string::npos; pos = name.find('/', pos + 1)) {
+      const std::string directory = name.substr(0, pos);
+      if (directories.insert(directory).second) {
+        output.MakeDirectory(directory);
+      }
+    }
+    
+    if (!reader.Read(name, &data)) {
+      std::cerr << "Could not read " << name << " from " << archive_filename << "\n";
+      success = false;
+      continue;
+    }
+    if (!output.Write(name, data)) {
+      success = false;
+      continue;
+    }
+    ++num_extracted;
+  }
   
-  // Allocate frame_buffer if necessary
-  if (g_frame_buffer == NULL) {
-    g_frame_buffer = cvCreateImage(cvSize(g_frame_width,
-                                          g_frame_height), IPL_DEPTH_8U, 3);
+  std::cout << "Extracted " << num_extracted << " of " << reader.Entries().size()
+            << " entries of " << archive_filename << " to " << output_root << "\n";
+  return success;
+}
+
+// Reads batch list of "INPUT_FILE_NAME OUTPUT_DIRECTORY_ROOT" lines. Empty
+// lines and lines starting with # are skipped.
+bool ReadBatchList(const std::string& filename,
+                   vector<std::pair<std::string, std::string> >* entries) {
+  std::ifstream ifs(filename.c_str());
+  if (!ifs) {
+    std::cerr << "Could not open batch list " << filename << "\n";
+    return false;
   }
   
-  // Render segmentation at specified level.
-  RenderRegionsRandomColor(g_frame_buffer->imageData,
-                           g_frame_buffer->widthStep,
-                           g_frame_buffer->width,
-                           g_frame_buffer->height,
-                           g_hierarchy_level,
-                           true,
-                           segmentation,
-                           g_seg_hierarchy);
+  std::string line;
+  int line_number = 0;
+  while (std::getline(ifs, line)) {
+    ++line_number;
+    std::stringstream line_stream(line);
+    std::string input;
+    std::string output;
+    if (!(line_stream >> input) || input[0] == '#')
+      continue;
+    if (!(line_stream >> output)) {
+      std::cerr << filename << ":" << line_number << ": Missing output directory.\n";
+      return false;
+    }
+    entries->push_back(std::make_pair(input, output));
+  }
+  return true;
 }
 
 //void FramePosChanged(int pos) {
@@ -83,36 +251,292 @@ void RenderCurrentFrame(int frame_number) {
 //}
 
 int main(int argc, char** argv) {
+  // Options start after the positional arguments: input and output, only the
+  // input in server mode, none in batch mode.
+  int first_option = 1;
+  while (first_option < argc && first_option < 3 &&
+         std::string(argv[first_option]).compare(0, 2, "--") != 0) {
+    ++first_option;
+  }
+  const int num_positional = first_option - 1;
+  
   // Get filename from command prompt.
-  if (argc != 3) {
-    std::cout << "Usage: segmentation_exporter INPUT_FILE_NAME OUTPUT_DIRECTORY_ROOT\n";
+  if (argc < 2) {
+    std::cout << "Usage: segmentation_exporter INPUT_FILE_NAME OUTPUT_DIRECTORY_ROOT [OPTIONS]\n"
+              << "       segmentation_exporter --batch=LIST [OPTIONS]\n"
+              << "       segmentation_exporter INPUT_FILE_NAME --serve=SOCKET [OPTIONS]\n"
+              << "       segmentation_exporter ARCHIVE --list\n"
+              << "       segmentation_exporter ARCHIVE OUTPUT_DIRECTORY_ROOT --extract\n"
+              << "Options:\n"
+              << "  --crop=X,Y,WIDTH,HEIGHT  Only render the specified rectangle.\n"
+              << "  --scale=N                Render at 1/N of the resolution.\n"
+              << "  --pyramid=N              Additionally write N thumbnail levels, each at\n"
+              << "                           half the resolution of the previous one.\n"
+              << "  --stats=FILE             Write per-region statistics for all levels\n"
+              << "                           (CSV for *.csv, binary table otherwise).\n"
+              << "  --graph=FILE             Write the region adjacency graph of all levels.\n"
+              << "  --stats-only             Only compute statistics and graph, skip rendering.\n"
+              << "  --contours               Write region contours for each frame and level.\n"
+              << "  --index=FILE             Region to frame index, built if FILE does not exist.\n"
+              << "  --mask=LEVEL:ID[,ID...]  Only export masks of the specified regions for the\n"
+              << "                           frames containing them.\n"
+              << "  --format=png|ppm|bmp|raw Output image format (default png).\n"
+              << "  --png-level=N            zlib compression level 0-9 (default 3).\n"
+              << "  --png-strategy=NAME      zlib strategy: default, filtered, huffman, rle\n"
+              << "                           or fixed (default default).\n"
+              << "  --no-palette             Always write RGB PNGs, never indexed ones.\n"
+              << "  --dedup=link|manifest|off\n"
+              << "                           Hardlink duplicate images to their first\n"
+              << "                           occurrence (default), list them in\n"
+              << "                           duplicates.txt or write them regardless.\n"
+              << "  --no-checkpoint          Do not record or resume completed frames.\n"
+              << "  --archive                Write all outputs into a single archive file at\n"
+              << "                           OUTPUT_DIRECTORY_ROOT instead of a directory tree.\n"
+              << "  --list                   List the entries of an archive.\n"
+              << "  --extract                Extract an archive into a directory tree.\n"
+              << "  --band-rows=N            Render and encode images in bands of N rows\n"
+              << "                           (default: sized to fit into the L2 cache).\n"
+              << "  --threads=N              Number of worker threads (default: number of\n"
+              << "                           processors).\n"
+              << "  --batch=LIST             Export all files listed in LIST, one\n"
+              << "                           \"INPUT_FILE_NAME OUTPUT_DIRECTORY_ROOT\" per line,\n"
+              << "                           on a shared pool of worker threads.\n"
+              << "  --serve=SOCKET           Serve render, query and mask requests on the Unix\n"
+              << "                           socket SOCKET (see render_server.h).\n"
+              << "  --frame-cache=N          Server mode: decoded frames kept in memory\n"
+              << "                           (default 64).\n"
+              << "  --image-cache=MB         Server mode: memory for rendered images\n"
+              << "                           (default 256).\n";
     return 1;
   }
   
+  ExportOptions options;
+  int num_threads = NumProcessors();
+  std::string batch_filename;
+  std::string socket_path;
+  RenderServerOptions server_options;
+  bool list_archive = false;
+  bool extract_archive = false;
+  for (int i = first_option; i < argc; ++i) {
+    std::string option(argv[i]);
+    if (option.compare(0, 7, "--crop=") == 0) {
+      RenderRect& crop = options.crop;
+      if (sscanf(option.c_str() + 7, "%d,%d,%d,%d",
+                 &crop.x, &crop.y, &crop.width, &crop.height) != 4 ||
+          crop.x < 0 || crop.y < 0 || crop.width <= 0 || crop.height <= 0) {
+        std::cerr << "Invalid crop rectangle: " << option << "\n";
+        return 1;
+      }
+      options.use_crop = true;
+    } else if (option.compare(0, 8, "--scale=") == 0) {
+      options.scale = atoi(option.c_str() + 8);
+      if (options.scale < 1) {
+        std::cerr << "Invalid scale: " << option << "\n";
+        return 1;
+      }
+    } else if (option.compare(0, 10, "--pyramid=") == 0) {
+      options.pyramid_levels = atoi(option.c_str() + 10);
+      if (options.pyramid_levels < 0 || options.pyramid_levels > 8) {
+        std::cerr << "Invalid number of pyramid levels: " << option << "\n";
+        return 1;
+      }
+    } else if (option.compare(0, 8, "--stats=") == 0) {
+      g_stats_filename = option.substr(8);
+    } else if (option.compare(0, 8, "--graph=") == 0) {
+      g_graph_filename = option.substr(8);
+    } else if (option == "--stats-only") {
+      g_stats_only = true;
+    } else if (option == "--contours") {
+      options.write_contours = true;
+    } else if (option.compare(0, 8, "--index=") == 0) {
+      g_index_filename = option.substr(8);
+    } else if (option.compare(0, 7, "--mask=") == 0) {
+      std::stringstream mask_stream(option.substr(7));
+      char separator = 0;
+      mask_stream >> g_mask_level >> separator;
+      int region_id;
+      while (separator == ':' || separator == ',') {
+        separator = 0;
+        if (!(mask_stream >> region_id))
+          break;
+        g_mask_region_ids.push_back(region_id);
+        mask_stream >> separator;
+      }
+      if (g_mask_level < 0 || g_mask_region_ids.empty()) {
+        std::cerr << "Invalid mask specification: " << option << "\n";
+        return 1;
+      }
+      g_export_mask = true;
+    } else if (option.compare(0, 9, "--format=") == 0) {
+      if (!ParseImageFormat(option.substr(9), &options.writer_options.format)) {
+        std::cerr << "Unknown image format: " << option << "\n";
+        return 1;
+      }
+    } else if (option.compare(0, 12, "--png-level=") == 0) {
+      int& level = options.writer_options.compression_level;
+      level = atoi(option.c_str() + 12);
+      if (level < 0 || level > 9) {
+        std::cerr << "Invalid compression level: " << option << "\n";
+        return 1;
+      }
+    } else if (option.compare(0, 15, "--png-strategy=") == 0) {
+      if (!ParseCompressionStrategy(option.substr(15),
+                                    &options.writer_options.compression_strategy)) {
+        std::cerr << "Unknown compression strategy: " << option << "\n";
+        return 1;
+      }
+    } else if (option == "--no-palette") {
+      options.writer_options.use_palette = false;
+    } else if (option.compare(0, 8, "--dedup=") == 0) {
+      const std::string mode = option.substr(8);
+      if (mode == "link") {
+        options.dedup_mode = DEDUP_LINK;
+      } else if (mode == "manifest") {
+        options.dedup_mode = DEDUP_MANIFEST;
+      } else if (mode == "off") {
+        options.dedup_mode = DEDUP_OFF;
+      } else {
+        std::cerr << "Unknown dedup mode: " << option << "\n";
+        return 1;
+      }
+    } else if (option == "--no-checkpoint") {
+      options.use_checkpoint = false;
+    } else if (option == "--archive") {
+      options.use_archive = true;
+    } else if (option.compare(0, 12, "--band-rows=") == 0) {
+      options.band_rows = atoi(option.c_str() + 12);
+      if (options.band_rows < 1) {
+        std::cerr << "Invalid number of band rows: " << option << "\n";
+        return 1;
+      }
+    } else if (option.compare(0, 10, "--threads=") == 0) {
+      num_threads = atoi(option.c_str() + 10);
+      if (num_threads < 1) {
+        std::cerr << "Invalid number of threads: " << option << "\n";
+        return 1;
+      }
+    } else if (option == "--list") {
+      list_archive = true;
+    } else if (option == "--extract") {
+      extract_archive = true;
+    } else if (option.compare(0, 8, "--batch=") == 0) {
+      batch_filename = option.substr(8);
+    } else if (option.compare(0, 8, "--serve=") == 0) {
+#ifdef _WIN32
+      // Unix domain sockets, see render_server.h.
+      std::cerr << "--serve is not supported on this platform.\n";
+      return 1;
+#else
+      socket_path = option.substr(8);
+#endif
+    } else if (option.compare(0, 14, "--frame-cache=") == 0) {
+      server_options.frame_cache_size = atoi(option.c_str() + 14);
+      if (server_options.frame_cache_size < 1) {
+        std::cerr << "Invalid frame cache size: " << option << "\n";
+        return 1;
+      }
+    } else if (option.compare(0, 14, "--image-cache=") == 0) {
+      server_options.image_cache_bytes = (int64_t)atoi(option.c_str() + 14) << 20;
+      if (server_options.image_cache_bytes < 0) {
+        std::cerr << "Invalid image cache size: " << option << "\n";
+        return 1;
+      }
+    } else {
+      std::cerr << "Unknown option: " << option << "\n";
+      return 1;
+    }
+    
+    // Options that change the output invalidate a previous checkpoint or
+    // archive.
+    if (option.compare(0, 10, "--threads=") != 0 &&
+        option.compare(0, 12, "--band-rows=") != 0 &&
+        option.compare(0, 8, "--batch=") != 0 &&
+        option != "--no-checkpoint") {
+      options.signature += " " + option;
+    }
+  }
+  
+  if (list_archive || extract_archive) {
+    if (num_positional != (list_archive ? 1 : 2) || first_option + 1 != argc) {
+      std::cerr << "Either ARCHIVE --list or ARCHIVE OUTPUT_DIRECTORY_ROOT --extract is "
+                << "required, without further options.\n";
+      return 1;
+    }
+    const bool success = list_archive ? ListArchive(argv[1]) : ExtractArchive(argv[1], argv[2]);
+    return success ? 0 : 1;
+  }
+  
+  const int required_positional = !batch_filename.empty() ? 0 : (!socket_path.empty() ? 1 : 2);
+  if (num_positional != required_positional || (!batch_filename.empty() && !socket_path.empty())) {
+    std::cerr << "Either INPUT_FILE_NAME OUTPUT_DIRECTORY_ROOT, --batch=LIST or "
+              << "INPUT_FILE_NAME --serve=SOCKET is required.\n";
+    return 1;
+  }
+  
+  if (!socket_path.empty()) {
+    if (!g_stats_filename.empty() || g_stats_only || !g_graph_filename.empty() ||
+        !g_index_filename.empty() || g_export_mask) {
+      std::cerr << "--stats, --stats-only, --graph, --index and --mask are not supported in "
+                << "server mode.\n";
+      return 1;
+    }
+    
+#ifndef _WIN32
+    server_options.export_options = options;
+    RenderServer server(argv[1], server_options);
+    if (!server.Open() || !server.Serve(socket_path)) {
+      return 1;
+    }
+#endif
+    return 0;
+  }
+  
+  if (!batch_filename.empty()) {
+    if (!g_stats_filename.empty() || g_stats_only || !g_graph_filename.empty() ||
+        !g_index_filename.empty() || g_export_mask) {
+      std::cerr << "--stats, --stats-only, --graph, --index and --mask are not supported in "
+                << "batch mode.\n";
+      return 1;
+    }
+    
+    vector<std::pair<std::string, std::string> > entries;
+    if (!ReadBatchList(batch_filename, &entries)) {
+      return 1;
+    }
+    
+    // One job is prepared ahead per worker to hide the latency of opening the
+    // next file.
+    BatchScheduler scheduler(num_threads, num_threads + 1);
+    for (int i = 0; i < (int)entries.size(); ++i) {
+      scheduler.AddJob(new ExportJob(entries[i].first, entries[i].second, options));
+    }
+    
+    std::cout << "Exporting " << entries.size() << " files with " << num_threads
+              << " threads.\n";
+    const int num_failed = scheduler.Run();
+    if (num_failed > 0) {
+      std::cerr << num_failed << " of " << entries.size() << " files failed.\n";
+      return 1;
+    }
+    return 0;
+  }
+
   std::string input_filename( argv[ 1 ] );
   std::string output_directory_root( argv[ 2 ] );
 
-  std::string mkdir_command = "mkdir " + output_directory_root;
-  std::cout << mkdir_command << std::endl;
-  system( mkdir_command.c_str() );
-
   //g_playing = false;
   
   // Read segmentation file.
   g_segment_reader = new SegmentationReader( input_filename );
   g_segment_reader->OpenFileAndReadHeader();
-  g_frame_pos = 0;
   
   std::cout << "Segmentation file " << input_filename << " contains " 
             << g_segment_reader->FrameNumber() << " frames.\n";
   
-  // Read first frame, it contains the hierarchy.
-  vector<Segment::uchar> data_buffer(g_segment_reader->ReadFrameSize());
-  g_segment_reader->ReadFrame(&data_buffer[0]);
-  
-  // Save hierarchy for all frames.
+  // Read first frame, it contains the hierarchy. Save hierarchy for all
+  // frames.
   g_seg_hierarchy = new SegmentationDesc;
-  g_seg_hierarchy->ParseFromArray(&data_buffer[0], data_buffer.size());
+  g_segment_reader->ReadFrame(0, g_seg_hierarchy);
 
   //g_frame_num_ = g_segment_reader->FrameNumber();
   g_frame_width = g_seg_hierarchy->frame_width();
@@ -120,36 +544,99 @@ int main(int argc, char** argv) {
   
   std::cout << "Video resolution: " << g_frame_width << "x" << g_frame_height << "\n";
   
+  g_render_rect = RenderRect(0, 0, g_frame_width, g_frame_height);
+  if (options.use_crop) {
+    // Clip crop rectangle to frame domain.
+    g_render_rect = options.crop;
+    g_render_rect.width = std::min(g_render_rect.width, g_frame_width - g_render_rect.x);
+    g_render_rect.height = std::min(g_render_rect.height, g_frame_height - g_render_rect.y);
+    if (g_render_rect.width <= 0 || g_render_rect.height <= 0) {
+      std::cerr << "Crop rectangle is outside of the frame.\n";
+      return 1;
+    }
+    std::cout << "Cropping to " << g_render_rect.width << "x" << g_render_rect.height
+              << " at (" << g_render_rect.x << ", " << g_render_rect.y << ")\n";
+  }
+  
+  if (!g_stats_filename.empty()) {
+    // Single pass over all frames, no rasterization.
+    SegmentationStats stats;
+    if (!ComputeSegmentationStats(g_segment_reader, &stats)) {
+      std::cerr << "Could not compute region statistics of " << argv[1] << "\n";
+      return 1;
+    }
+    
+    const std::string csv_suffix(".csv");
+    bool success;
+    if (g_stats_filename.size() >= csv_suffix.size() &&
+        g_stats_filename.compare(g_stats_filename.size() - csv_suffix.size(),
+                                 csv_suffix.size(), csv_suffix) == 0) {
+      success = stats.WriteCSV(g_stats_filename);
+    } else {
+      success = stats.WriteBinary(g_stats_filename);
+    }
+    
+    if (!success) {
+      return 1;
+    }
+    std::cout << "Wrote region statistics to " << g_stats_filename << "\n";
+  }
+  
+  if (!g_graph_filename.empty()) {
+    // Single pass over all frames, only neighbor ids are used.
+    RegionGraph graph;
+    if (!graph.Build(g_segment_reader) || !graph.WriteToFile(g_graph_filename)) {
+      std::cerr << "Could not write region graph to " << g_graph_filename << "\n";
+      return 1;
+    }
+    std::cout << "Wrote region graph to " << g_graph_filename << "\n";
+  }
+  
+  if (g_export_mask || !g_index_filename.empty()) {
+    RegionFrameIndex index;
+    if (g_index_filename.empty() || !index.ReadFromFile(g_index_filename) ||
+        !index.IsIndexOf(*g_segment_reader)) {
+      std::cout << "Building region index.\n";
+      if (!index.Build(g_segment_reader)) {
+        std::cerr << "Could not build region index of " << argv[1] << "\n";
+        return 1;
+      }
+      if (!g_index_filename.empty() && !index.WriteToFile(g_index_filename)) {
+        std::cerr << "Could not write region index to " << g_index_filename << "\n";
+        return 1;
+      }
+    }
+    
+    if (g_export_mask) {
+      ExportOutput output(output_directory_root, options.use_archive, options.dedup_mode);
+      output.MakeDirectory("");
+      if (!output.Open("segmentation_exporter masks " + input_filename + options.signature,
+                       false)) {
+        return 1;
+      }
+      const bool success = ExportMasks(index, ImageWriter(options.writer_options), &output);
+      if (!output.Close() || !success) {
+        return 1;
+      }
+    }
+  }
+  
+  g_segment_reader->CloseFile();
+  delete g_segment_reader;
+  delete g_seg_hierarchy;
+  
+  if (g_stats_only || g_export_mask) {
+    return 0;
+  }
+  
   // Create OpenCV window.
   //cvNamedWindow("main_window");
   
-  RenderCurrentFrame(0);
-
-  for ( int j = 0; j < g_seg_hierarchy->hierarchy_size() + 2; j++ ) {
-    std::stringstream directory_name_stream;
-    #ifdef _WIN32 // works for both 32 and 64 bit
-      directory_name_stream << output_directory_root << "\\" << "hierarchy_level_" << std::setfill( '0' ) << std::setw( 2 ) << j;
-    #else
-      directory_name_stream << output_directory_root << "/" << "hierarchy_level_" << std::setfill( '0' ) << std::setw( 2 ) << j;
-    #endif
-    std::string directory_name = directory_name_stream.str();
-
-    std::string mkdir_command = "mkdir " + directory_name;
-    std::cout << mkdir_command << std::endl;
-    system( mkdir_command.c_str() );
-
-    for ( int i = 0; i < g_segment_reader->FrameNumber(); i++ ) {
-      g_frame_pos       = i;
-      g_hierarchy_level = j;
-      RenderCurrentFrame(g_frame_pos);
-
-      std::stringstream file_name_stream;
-      file_name_stream << directory_name << "/" << std::setfill( '0' ) << std::setw( 6 ) << i + 1 << ".png";
-      std::string file_name = file_name_stream.str();
-
-      std::cout << file_name << std::endl;
-      cvSaveImage( file_name.c_str(), g_frame_buffer );
-    }
+  // Frames of a single file are exported in parallel as well.
+  BatchScheduler scheduler(num_threads, 1);
+  scheduler.AddJob(new ExportJob(input_filename, output_directory_root, options));
+  if (scheduler.Run() > 0) {
+    return 1;
   }
 
   //cvShowImage("main_window", g_frame_buffer);
@@ -194,11 +681,5 @@ int main(int argc, char** argv) {
   //  }
   //}
   
-  g_segment_reader->CloseFile();
-  delete g_segment_reader;
-  
-  cvReleaseImage(&g_frame_buffer);
-  delete g_seg_hierarchy;
-  
-   return 0;
+  return 0;
 }
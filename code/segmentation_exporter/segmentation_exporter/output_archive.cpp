@@ -0,0 +1,291 @@
+/*
+ *  output_archive.cpp
+ *  segmentation_exporter
+ *
+ */
+
+#include "output_archive.h"
+
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace Segment {
+
+  namespace {
+    const char kArchiveMagic[8] = { 'S', 'G', 'A', 'R', 'C', 'H', '0', '1' };
+    const char kIndexMagic[8] = { 'S', 'G', 'A', 'R', 'I', 'D', 'X', '1' };
+    const int kRecordTag = 0x52524753;
+    const int kIndexTag = 0x49524753;
+
+    // Names are relative paths, longer names indicate a corrupted record.
+    const int kMaxNameLength = 4096;
+
+    // Size of record header without name.
+    const int kRecordHeaderSize = 2 * sizeof(int) + 2 * sizeof(int64_t);
+
+    bool TruncateFile(const string& filename, int64_t size) {
+#ifdef _WIN32
+      int fd = _open(filename.c_str(), _O_RDWR | _O_BINARY);
+      if (fd < 0)
+        return false;
+      const bool success = _chsize_s(fd, size) == 0;
+      _close(fd);
+      return success;
+#else
+      return truncate(filename.c_str(), size) == 0;
+#endif
+    }
+
+    template <class T>
+    bool ReadValue(std::ifstream& ifs, T* value) {
+      return ifs.read(reinterpret_cast<char*>(value), sizeof(T)).good();
+    }
+
+    bool ReadName(std::ifstream& ifs, string* name) {
+      int name_length;
+      if (!ReadValue(ifs, &name_length) || name_length < 0 || name_length > kMaxNameLength)
+        return false;
+      name->resize(name_length);
+      return name_length == 0 || ifs.read(&(*name)[0], name_length).good();
+    }
+  }  // namespace.
+
+  ArchiveWriter::~ArchiveWriter() {
+    if (ofs_.is_open()) {
+      Close();
+    }
+  }
+
+  bool ArchiveWriter::Open(const string& signature, bool resume) {
+    entries_.clear();
+    buffer_.clear();
+    buffer_.reserve(buffer_size_);
+
+    const int64_t recovered_end = resume ? Recover(signature) : -1;
+    if (recovered_end > 0) {
+      // Drop incomplete records and the index of a finished run.
+      if (!TruncateFile(filename_, recovered_end)) {
+        std::cerr << "ArchiveWriter::Open: Could not truncate " << filename_ << "\n";
+        return false;
+      }
+      ofs_.open(filename_.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::app);
+      position_ = recovered_end;
+    } else {
+      entries_.clear();
+      ofs_.open(filename_.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+      position_ = 0;
+      Append(kArchiveMagic, sizeof(kArchiveMagic));
+      const int signature_length = signature.size();
+      Append(&signature_length, sizeof(signature_length));
+      Append(signature.data(), signature_length);
+    }
+
+    if (!ofs_) {
+      std::cerr << "ArchiveWriter::Open: Could not open " << filename_ << " to write!\n";
+      return false;
+    }
+
+    num_recovered_ = entries_.size();
+    return true;
+  }
+
+  int64_t ArchiveWriter::Recover(const string& signature) {
+    std::ifstream ifs(filename_.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!ifs)
+      return -1;
+
+    ifs.seekg(0, std::ios_base::end);
+    const int64_t file_size = ifs.tellg();
+    ifs.seekg(0, std::ios_base::beg);
+
+    char magic[sizeof(kArchiveMagic)];
+    string file_signature;
+    if (!ifs.read(magic, sizeof(magic)) ||
+        memcmp(magic, kArchiveMagic, sizeof(magic)) != 0 ||
+        !ReadName(ifs, &file_signature) ||
+        file_signature != signature) {
+      return -1;
+    }
+
+    int64_t end = ifs.tellg();
+    while (true) {
+      int tag;
+      string name;
+      int64_t data_offset;
+      int64_t data_size;
+      if (!ReadValue(ifs, &tag) || tag != kRecordTag ||
+          !ReadName(ifs, &name) ||
+          !ReadValue(ifs, &data_offset) ||
+          !ReadValue(ifs, &data_size) ||
+          data_size < 0) {
+        break;
+      }
+
+      const int64_t data_begin = end + kRecordHeaderSize + name.size();
+      if (data_offset == data_begin) {
+        // Record with data.
+        if (data_begin + data_size > file_size)
+          break;
+        ifs.seekg(data_size, std::ios_base::cur);
+        end = data_begin + data_size;
+      } else {
+        // Reference to previous record.
+        if (data_offset < 0 || data_offset + data_size > end)
+          break;
+        end = data_begin;
+      }
+
+      entries_[name] = std::make_pair(data_offset, data_size);
+    }
+
+    return end;
+  }
+
+  bool ArchiveWriter::Add(const string& name, const uchar* data, int64_t size) {
+    const int64_t data_offset = position_ + kRecordHeaderSize + name.size();
+    AppendRecordHeader(name, data_offset, size);
+    Append(data, size);
+    entries_[name] = std::make_pair(data_offset, size);
+    return ofs_.good();
+  }
+
+  bool ArchiveWriter::AddReference(const string& name, const string& source) {
+    std::map<string, std::pair<int64_t, int64_t> >::const_iterator source_entry =
+        entries_.find(source);
+    if (source_entry == entries_.end()) {
+      std::cerr << "ArchiveWriter::AddReference: Unknown entry " << source << "\n";
+      return false;
+    }
+
+    // Copy, insertion below might invalidate source_entry.
+    const std::pair<int64_t, int64_t> location = source_entry->second;
+    AppendRecordHeader(name, location.first, location.second);
+    entries_[name] = location;
+    return ofs_.good();
+  }
+
+  bool ArchiveWriter::Close() {
+    const int64_t index_offset = position_;
+    const int index_tag = kIndexTag;
+    const int num_entries = entries_.size();
+    Append(&index_tag, sizeof(index_tag));
+    Append(&num_entries, sizeof(num_entries));
+    for (std::map<string, std::pair<int64_t, int64_t> >::const_iterator entry = entries_.begin();
+         entry != entries_.end();
+         ++entry) {
+      const int name_length = entry->first.size();
+      Append(&name_length, sizeof(name_length));
+      Append(entry->first.data(), name_length);
+      Append(&entry->second.first, sizeof(int64_t));
+      Append(&entry->second.second, sizeof(int64_t));
+    }
+
+    Append(&index_offset, sizeof(index_offset));
+    Append(kIndexMagic, sizeof(kIndexMagic));
+
+    const bool success = Flush();
+    ofs_.close();
+    return success;
+  }
+
+  void ArchiveWriter::AppendRecordHeader(const string& name,
+                                         int64_t data_offset,
+                                         int64_t data_size) {
+    const int record_tag = kRecordTag;
+    const int name_length = name.size();
+    Append(&record_tag, sizeof(record_tag));
+    Append(&name_length, sizeof(name_length));
+    Append(name.data(), name_length);
+    Append(&data_offset, sizeof(data_offset));
+    Append(&data_size, sizeof(data_size));
+  }
+
+  void ArchiveWriter::Append(const void* data, int64_t size) {
+    if ((int64_t)buffer_.size() + size > buffer_size_) {
+      Flush();
+    }
+
+    if (size >= buffer_size_) {
+      // Large chunks are written directly.
+      ofs_.write(reinterpret_cast<const char*>(data), size);
+    } else {
+      const char* data_ptr = reinterpret_cast<const char*>(data);
+      buffer_.insert(buffer_.end(), data_ptr, data_ptr + size);
+    }
+    position_ += size;
+  }
+
+  bool ArchiveWriter::Flush() {
+    if (!buffer_.empty()) {
+      ofs_.write(&buffer_[0], buffer_.size());
+      buffer_.clear();
+    }
+    ofs_.flush();
+    return ofs_.good();
+  }
+
+  bool ArchiveReader::Open() {
+    ifs_.open(filename_.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!ifs_) {
+      std::cerr << "ArchiveReader::Open: Could not open " << filename_ << "\n";
+      return false;
+    }
+
+    // Read footer.
+    int64_t index_offset;
+    char magic[sizeof(kIndexMagic)];
+    ifs_.seekg(-(int)(sizeof(index_offset) + sizeof(magic)), std::ios_base::end);
+    if (!ReadValue(ifs_, &index_offset) ||
+        !ifs_.read(magic, sizeof(magic)) ||
+        memcmp(magic, kIndexMagic, sizeof(magic)) != 0) {
+      std::cerr << "ArchiveReader::Open: " << filename_ << " has no index. "
+                << "Archive was not closed.\n";
+      return false;
+    }
+
+    ifs_.seekg(index_offset);
+    int index_tag;
+    int num_entries;
+    if (!ReadValue(ifs_, &index_tag) || index_tag != kIndexTag ||
+        !ReadValue(ifs_, &num_entries)) {
+      std::cerr << "ArchiveReader::Open: Corrupted index in " << filename_ << "\n";
+      return false;
+    }
+
+    entries_.clear();
+    for (int i = 0; i < num_entries; ++i) {
+      string name;
+      std::pair<int64_t, int64_t> location;
+      if (!ReadName(ifs_, &name) ||
+          !ReadValue(ifs_, &location.first) ||
+          !ReadValue(ifs_, &location.second)) {
+        std::cerr << "ArchiveReader::Open: Corrupted index in " << filename_ << "\n";
+        return false;
+      }
+      entries_[name] = location;
+    }
+
+    return true;
+  }
+
+  bool ArchiveReader::Read(const string& name, vector<uchar>* data) {
+    std::map<string, std::pair<int64_t, int64_t> >::const_iterator entry = entries_.find(name);
+    if (entry == entries_.end())
+      return false;
+
+    data->resize(entry->second.second);
+    ifs_.clear();
+    ifs_.seekg(entry->second.first);
+    return data->empty() ||
+           ifs_.read(reinterpret_cast<char*>(&(*data)[0]), data->size()).good();
+  }
+
+}  // namespace Segment.
@@ -0,0 +1,128 @@
+/*
+ *  output_archive.h
+ *  segmentation_exporter
+ *
+ *  Single file container for exported outputs.
+ *
+ */
+
+// Instead of one file per frame and level, all outputs can be appended to a
+// single archive, avoiding file and directory creation on shared file systems.
+// Records are buffered and written in large sequential chunks, a trailing
+// index allows random access by name.
+//
+// Layout (native byte order, as segmentation_io):
+//   char[8]   "SGARCH01"
+//   int32     signature length, followed by signature
+//   Records, each:
+//     int32   kRecordTag
+//     int32   name length, followed by name
+//     int64   data offset
+//     int64   data size
+//     data, only present if data offset equals the position right after the
+//     record header. Otherwise the record references the data of a previous
+//     record (used for duplicate outputs).
+//   Index:
+//     int32   kIndexTag
+//     int32   number of entries, each:
+//       int32 name length, followed by name
+//       int64 data offset
+//       int64 data size
+//   int64     offset of the index
+//   char[8]   "SGARIDX1"
+//
+// Records are self-describing, so an archive whose writer was interrupted can
+// be recovered by scanning its records up to the first incomplete one.
+
+#ifndef OUTPUT_ARCHIVE_H__
+#define OUTPUT_ARCHIVE_H__
+
+#include <fstream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef __linux
+  #include <stdint.h>
+#endif
+
+#ifdef _WIN32
+  typedef __int64 int64_t;
+#endif
+
+namespace Segment {
+  typedef unsigned char uchar;
+  using std::string;
+  using std::vector;
+
+  class ArchiveWriter {
+  public:
+    // Records are buffered up to buffer_size bytes.
+    ArchiveWriter(const string& filename, int buffer_size = 1 << 22)
+        : filename_(filename), buffer_size_(buffer_size), position_(0), num_recovered_(0) {}
+
+    ~ArchiveWriter();
+
+    // Creates archive with the passed signature. If resume is set and the file
+    // is an archive with the same signature, all of its complete records are
+    // kept and new records are appended.
+    bool Open(const string& signature, bool resume);
+
+    // Number of entries kept from a previous run.
+    int NumRecovered() const { return num_recovered_; }
+
+    bool Contains(const string& name) const { return entries_.find(name) != entries_.end(); }
+
+    // Appends data under name. Adding an existing name replaces its entry.
+    bool Add(const string& name, const uchar* data, int64_t size);
+
+    // Adds name referencing the data of the existing entry source.
+    bool AddReference(const string& name, const string& source);
+
+    // Writes index and closes the archive.
+    bool Close();
+
+  private:
+    void AppendRecordHeader(const string& name, int64_t data_offset, int64_t data_size);
+    void Append(const void* data, int64_t size);
+    bool Flush();
+
+    // Returns end of last complete record of an existing archive with
+    // signature and fills entries_, or -1 if no such archive exists.
+    int64_t Recover(const string& signature);
+
+    string filename_;
+    int buffer_size_;
+
+    std::ofstream ofs_;
+    vector<char> buffer_;
+
+    // Logical end of archive including buffered data.
+    int64_t position_;
+
+    // Maps name to (data offset, data size).
+    std::map<string, std::pair<int64_t, int64_t> > entries_;
+    int num_recovered_;
+  };
+
+  class ArchiveReader {
+  public:
+    ArchiveReader(const string& filename) : filename_(filename) {}
+
+    // Reads the trailing index.
+    bool Open();
+
+    // Returns false if name is not present.
+    bool Read(const string& name, vector<uchar>* data);
+
+    const std::map<string, std::pair<int64_t, int64_t> >& Entries() const { return entries_; }
+
+  private:
+    string filename_;
+    std::ifstream ifs_;
+    std::map<string, std::pair<int64_t, int64_t> > entries_;
+  };
+
+}  // namespace Segment.
+
+#endif  // OUTPUT_ARCHIVE_H__
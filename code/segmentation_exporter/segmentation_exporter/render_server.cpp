@@ -0,0 +1,471 @@
+/*
+ *  render_server.cpp
+ *  segmentation_exporter
+ *
+ */
+
+#include "render_server.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+namespace Segment {
+
+  namespace {
+    // Requests are single lines, longer input is rejected.
+    const size_t kMaxRequestLength = 64 * 1024;
+
+    volatile sig_atomic_t g_interrupted = 0;
+
+    void HandleInterrupt(int) {
+      g_interrupted = 1;
+    }
+
+    struct Client {
+      explicit Client(int fd_) : fd(fd_), closed(false) {}
+
+      int fd;
+      bool closed;
+
+      // Received data not yet terminated by a newline.
+      string input;
+    };
+
+    bool SendAll(int fd, const char* data, size_t sz) {
+      while (sz > 0) {
+        const ssize_t sent = send(fd, data, sz, 0);
+        if (sent < 0) {
+          if (errno == EINTR)
+            continue;
+          return false;
+        }
+        data += sent;
+        sz -= sent;
+      }
+      return true;
+    }
+
+    void AppendOK(const char* payload, size_t sz, string* response) {
+      std::ostringstream status;
+      status << "OK " << sz << "\n";
+      *response += status.str();
+      response->append(payload, sz);
+    }
+
+    void AppendText(const string& text, string* response) {
+      AppendOK(text.data(), text.size(), response);
+    }
+
+    void AppendError(const string& message, string* response) {
+      *response += "ERROR " + message + "\n";
+    }
+
+    // Reads an optional scale argument, default_scale if absent. Returns false
+    // if the scale is invalid.
+    bool ParseScale(std::istream* request_stream, int default_scale, int* scale) {
+      *scale = default_scale;
+      string scale_arg;
+      if (*request_stream >> scale_arg) {
+        *scale = atoi(scale_arg.c_str());
+      }
+      return *scale >= 1;
+    }
+
+    // Parses comma separated ids. Returns false on malformed input.
+    bool ParseIds(const string& ids, vector<int>* region_ids) {
+      std::istringstream ids_stream(ids);
+      int id;
+      char separator = ',';
+      while (separator == ',' && ids_stream >> id) {
+        region_ids->push_back(id);
+        separator = 0;
+        ids_stream >> separator;
+      }
+      return !region_ids->empty() && ids_stream.eof();
+    }
+  }  // namespace.
+
+  RenderServer::RenderServer(const string& input_filename, const RenderServerOptions& options)
+      : input_filename_(input_filename),
+        options_(options),
+        reader_(input_filename),
+        max_level_(0),
+        image_writer_(options.export_options.writer_options),
+        renderer_(options.export_options.band_rows),
+        frame_cache_(options.frame_cache_size),
+        image_cache_(options.image_cache_bytes),
+        frame_hits_(0),
+        frame_misses_(0),
+        image_hits_(0),
+        image_misses_(0),
+        shutdown_(false) {
+  }
+
+  RenderServer::~RenderServer() {
+    reader_.CloseFile();
+  }
+
+  bool RenderServer::Open() {
+    if (!reader_.OpenFileAndReadHeader())
+      return false;
+
+    if (reader_.FrameNumber() == 0) {
+      std::cerr << "Segmentation file " << input_filename_ << " contains no frames.\n";
+      return false;
+    }
+
+    // First frame contains the hierarchy.
+    if (!reader_.ReadFrame(0, &hierarchy_)) {
+      std::cerr << "Could not read first frame of " << input_filename_ << "\n";
+      return false;
+    }
+
+    const ExportOptions& export_options = options_.export_options;
+    const int frame_width = hierarchy_.frame_width();
+    const int frame_height = hierarchy_.frame_height();
+    render_rect_ = RenderRect(0, 0, frame_width, frame_height);
+    if (export_options.use_crop) {
+      // Clip crop rectangle to frame domain.
+      render_rect_ = export_options.crop;
+      render_rect_.width = std::min(render_rect_.width, frame_width - render_rect_.x);
+      render_rect_.height = std::min(render_rect_.height, frame_height - render_rect_.y);
+      if (render_rect_.width <= 0 || render_rect_.height <= 0) {
+        std::cerr << "Crop rectangle is outside of the frames of " << input_filename_ << "\n";
+        return false;
+      }
+    }
+
+    max_level_ = hierarchy_.hierarchy_size();
+    return true;
+  }
+
+  bool RenderServer::Serve(const string& socket_path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+      std::cerr << "Socket path " << socket_path << " is too long.\n";
+      return false;
+    }
+    strcpy(address.sun_path, socket_path.c_str());
+
+    const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+      std::cerr << "Could not create socket: " << strerror(errno) << "\n";
+      return false;
+    }
+
+    // Replace the socket of a previous server that was not shut down, but
+    // neither a running server's socket nor any other file.
+    struct stat socket_stat;
+    if (lstat(socket_path.c_str(), &socket_stat) == 0) {
+      if (!S_ISSOCK(socket_stat.st_mode) ||
+          connect(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+        std::cerr << socket_path << " exists and is not a stale socket.\n";
+        close(listen_fd);
+        return false;
+      }
+      unlink(socket_path.c_str());
+    }
+
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listen_fd, 16) != 0) {
+      std::cerr << "Could not listen on " << socket_path << ": " << strerror(errno) << "\n";
+      close(listen_fd);
+      return false;
+    }
+
+    // Disconnected clients are detected by failing sends, interrupts stop the
+    // server cleanly.
+    signal(SIGPIPE, SIG_IGN);
+    g_interrupted = 0;
+    signal(SIGINT, HandleInterrupt);
+    signal(SIGTERM, HandleInterrupt);
+
+    std::cout << "Serving " << input_filename_ << " (" << reader_.FrameNumber() << " frames, "
+              << hierarchy_.frame_width() << "x" << hierarchy_.frame_height() << ") on "
+              << socket_path << "\n";
+
+    vector<Client> clients;
+    vector<pollfd> poll_fds;
+    shutdown_ = false;
+    while (!shutdown_ && !g_interrupted) {
+      poll_fds.resize(clients.size() + 1);
+      poll_fds[0].fd = listen_fd;
+      for (int i = 0; i < (int)clients.size(); ++i) {
+        poll_fds[i + 1].fd = clients[i].fd;
+      }
+      for (int i = 0; i < (int)poll_fds.size(); ++i) {
+        poll_fds[i].events = POLLIN;
+        poll_fds[i].revents = 0;
+      }
+
+      if (poll(&poll_fds[0], poll_fds.size(), -1) < 0) {
+        if (errno == EINTR)
+          continue;
+        std::cerr << "RenderServer::Serve: poll failed: " << strerror(errno) << "\n";
+        break;
+      }
+
+      // Serve pending requests of each client before accepting new ones.
+      for (int i = 0; i < (int)clients.size() && !shutdown_; ++i) {
+        if (poll_fds[i + 1].revents == 0)
+          continue;
+
+        Client& client = clients[i];
+        char data[4096];
+        const ssize_t received = recv(client.fd, data, sizeof(data), 0);
+        if (received <= 0) {
+          if (received < 0 && errno == EINTR)
+            continue;
+          client.closed = true;
+          continue;
+        }
+
+        client.input.append(data, received);
+        size_t line_end;
+        while (!shutdown_ && (line_end = client.input.find('\n')) != string::npos) {
+          string request = client.input.substr(0, line_end);
+          client.input.erase(0, line_end + 1);
+          if (!request.empty() && request[request.size() - 1] == '\r')
+            request.erase(request.size() - 1);
+
+          string response;
+          HandleRequest(request, &response);
+          if (!SendAll(client.fd, response.data(), response.size())) {
+            client.closed = true;
+            break;
+          }
+        }
+
+        if (client.input.size() > kMaxRequestLength) {
+          string response;
+          AppendError("Request too long", &response);
+          SendAll(client.fd, response.data(), response.size());
+          client.closed = true;
+        }
+      }
+
+      // Remove disconnected clients.
+      for (int i = clients.size() - 1; i >= 0; --i) {
+        if (clients[i].closed) {
+          close(clients[i].fd);
+          clients.erase(clients.begin() + i);
+        }
+      }
+
+      if ((poll_fds[0].revents & POLLIN) && !shutdown_) {
+        const int client_fd = accept(listen_fd, 0, 0);
+        if (client_fd >= 0) {
+          clients.push_back(Client(client_fd));
+        }
+      }
+    }
+
+    for (int i = 0; i < (int)clients.size(); ++i) {
+      close(clients[i].fd);
+    }
+    close(listen_fd);
+    unlink(socket_path.c_str());
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    std::cout << "Server stopped.\n";
+    return true;
+  }
+
+  void RenderServer::HandleRequest(const string& request, string* response) {
+    std::istringstream request_stream(request);
+    string command;
+    request_stream >> command;
+
+    if (command == "INFO") {
+      std::ostringstream info;
+      info << reader_.FrameNumber() << " " << hierarchy_.frame_width() << " "
+           << hierarchy_.frame_height() << " " << max_level_ + 1 << "\n";
+      AppendText(info.str(), response);
+      return;
+    }
+
+    if (command == "STATS") {
+      std::ostringstream stats;
+      stats << "frame_hits=" << frame_hits_ << " frame_misses=" << frame_misses_
+            << " frames_cached=" << frame_cache_.Size()
+            << " image_hits=" << image_hits_ << " image_misses=" << image_misses_
+            << " images_cached=" << image_cache_.Size()
+            << " image_bytes=" << image_cache_.TotalCost() << "\n";
+      AppendText(stats.str(), response);
+      return;
+    }
+
+    if (command == "SHUTDOWN") {
+      shutdown_ = true;
+      AppendText("", response);
+      return;
+    }
+
+    if (command != "RENDER" && command != "QUERY" && command != "MASK") {
+      AppendError("Unknown request " + command, response);
+      return;
+    }
+
+    int frame = -1;
+    int level = -1;
+    request_stream >> frame >> level;
+    if (!request_stream || level < 0) {
+      AppendError("Invalid frame or level", response);
+      return;
+    }
+
+    if (frame < 0 || frame >= reader_.FrameNumber()) {
+      AppendError("Frame out of range", response);
+      return;
+    }
+
+    if (command == "RENDER") {
+      int scale = 0;
+      if (!ParseScale(&request_stream, options_.export_options.scale, &scale)) {
+        AppendError("Invalid scale", response);
+        return;
+      }
+
+      const vector<uchar>* image = RenderedImage(frame, level, scale);
+      if (!image) {
+        AppendError("Could not render frame", response);
+        return;
+      }
+      AppendOK(reinterpret_cast<const char*>(&(*image)[0]), image->size(), response);
+    } else if (command == "QUERY") {
+      int x = -1;
+      int y = -1;
+      request_stream >> x >> y;
+      if (!request_stream) {
+        AppendError("Invalid point", response);
+        return;
+      }
+
+      const SegmentationDesc* desc = Frame(frame);
+      if (!desc) {
+        AppendError("Could not read frame", response);
+        return;
+      }
+
+      std::ostringstream region_id;
+      region_id << GetRegionIdFromPoint(x, y, level, *desc, &hierarchy_) << "\n";
+      AppendText(region_id.str(), response);
+    } else {
+      string ids;
+      vector<int> region_ids;
+      request_stream >> ids;
+      if (!ParseIds(ids, &region_ids)) {
+        AppendError("Invalid region ids", response);
+        return;
+      }
+
+      int scale = 0;
+      if (!ParseScale(&request_stream, options_.export_options.scale, &scale)) {
+        AppendError("Invalid scale", response);
+        return;
+      }
+
+      if (!RenderMask(frame, level, scale, region_ids, &encoded_)) {
+        AppendError("Could not render mask", response);
+        return;
+      }
+      AppendOK(reinterpret_cast<const char*>(&encoded_[0]), encoded_.size(), response);
+    }
+  }
+
+  const SegmentationDesc* RenderServer::Frame(int frame) {
+    SegmentationDesc* desc = frame_cache_.Find(frame);
+    if (desc) {
+      ++frame_hits_;
+      return desc;
+    }
+
+    ++frame_misses_;
+    if (!reader_.ReadFrame(frame, &frame_buffer_))
+      return 0;
+
+    // The frame buffer keeps its copy for delta decoding of the next frame.
+    desc = frame_cache_.Insert(frame, 1);
+    desc->CopyFrom(frame_buffer_.desc);
+    return desc;
+  }
+
+  const vector<uchar>* RenderServer::RenderedImage(int frame, int level, int scale) {
+    // Levels above the coarsest one render identically.
+    level = std::min(level, max_level_);
+    const ImageKey key(frame, std::make_pair(level, scale));
+    vector<uchar>* image = image_cache_.Find(key);
+    if (image) {
+      ++image_hits_;
+      return image;
+    }
+
+    ++image_misses_;
+    const SegmentationDesc* desc = Frame(frame);
+    if (!desc)
+      return 0;
+
+    ImageBandEncoder encoder(image_writer_.options());
+    EncodingBandConsumer consumer(&encoder);
+    if (!encoder.Begin(ScaledSize(render_rect_.width, scale),
+                       ScaledSize(render_rect_.height, scale),
+                       3,
+                       &encoded_) ||
+        !renderer_.RenderRegionsRandomColor(render_rect_,
+                                            scale,
+                                            level,
+                                            true,
+                                            *desc,
+                                            &hierarchy_,
+                                            &consumer) ||
+        !encoder.Finish()) {
+      return 0;
+    }
+
+    image = image_cache_.Insert(key, encoded_.size());
+    image->swap(encoded_);
+    return image;
+  }
+
+  bool RenderServer::RenderMask(int frame,
+                                int level,
+                                int scale,
+                                const vector<int>& region_ids,
+                                vector<uchar>* encoded) {
+    const SegmentationDesc* desc = Frame(frame);
+    if (!desc)
+      return false;
+
+    // Rendered through the region ids, which support scaled rendering. Pixels
+    // not covered by any region keep id -1.
+    const int width = ScaledSize(render_rect_.width, scale);
+    const int height = ScaledSize(render_rect_.height, scale);
+    vector<int> id_image(width * height, -1);
+    SegmentationDescToIdImageScaled(&id_image[0], width * sizeof(int), render_rect_, scale,
+                                    level, *desc, &hierarchy_);
+
+    vector<int> sorted_ids(region_ids);
+    std::sort(sorted_ids.begin(), sorted_ids.end());
+    vector<uchar> mask(width * height, 0);
+    for (int i = 0; i < width * height; ++i) {
+      if (std::binary_search(sorted_ids.begin(), sorted_ids.end(), id_image[i]))
+        mask[i] = 255;
+    }
+    return image_writer_.Encode(&mask[0], width, width, height, 1, encoded);
+  }
+
+}  // namespace Segment.
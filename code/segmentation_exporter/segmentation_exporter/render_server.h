@@ -0,0 +1,133 @@
+/*
+ *  render_server.h
+ *  segmentation_exporter
+ *
+ *  Long-running render server for interactive clients.
+ *
+ */
+
+// A RenderServer opens a segmentation file once and answers render, point
+// query and mask requests over a local Unix domain socket, e.g. for an
+// annotation UI that would otherwise run the exporter for every click.
+// Decoded frames and encoded level images are kept in LRU caches, so repeated
+// requests (scrubbing back and forth) are served from memory.
+//
+// Protocol: each request is a line of text, arguments separated by spaces.
+//   INFO                            Number of frames, frame width and height
+//                                   and number of hierarchy levels.
+//   RENDER FRAME LEVEL [SCALE]      Image of FRAME at LEVEL, rendered as by
+//                                   the exporter at 1 / SCALE (default: the
+//                                   --scale option) and encoded in the
+//                                   --format of the server.
+//   QUERY FRAME LEVEL X Y           Id of the region at LEVEL containing the
+//                                   frame pixel (X, Y), -1 if none.
+//   MASK FRAME LEVEL ID[,ID...] [SCALE]
+//                                   8-bit mask of the regions at LEVEL, 255
+//                                   inside the regions and 0 elsewhere, at
+//                                   1 / SCALE as for RENDER.
+//   STATS                           Cache hits, misses and sizes.
+//   SHUTDOWN                        Stops the server.
+// Each response starts with a status line. On success it is "OK N" followed
+// by N bytes of payload; text payloads (INFO, QUERY, STATS) are a single line
+// including the newline. Failures are reported as "ERROR MESSAGE" without
+// payload. Connections stay open for any number of requests. Frame numbers
+// start at 0, levels are counted as in the exporter output.
+
+#ifndef RENDER_SERVER_H__
+#define RENDER_SERVER_H__
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "export_job.h"
+#include "image_writer.h"
+#include "lru_cache.h"
+#include "segmentation.pb.h"
+#include "segmentation_io.h"
+#include "segmentation_util.h"
+
+namespace Segment {
+  using std::string;
+  using std::vector;
+
+  struct RenderServerOptions {
+    RenderServerOptions() : frame_cache_size(64), image_cache_bytes(256 << 20) {}
+
+    // Crop, scale, image format and band rows are used as in the exporter.
+    ExportOptions export_options;
+
+    // Number of decoded frames kept in memory.
+    int frame_cache_size;
+
+    // Memory for encoded images.
+    int64_t image_cache_bytes;
+  };
+
+  class RenderServer {
+  public:
+    RenderServer(const string& input_filename, const RenderServerOptions& options);
+    ~RenderServer();
+
+    // Reads the hierarchy. Returns false on error.
+    bool Open();
+
+    // Listens on socket_path and serves requests until SHUTDOWN is received or
+    // the process is interrupted (SIGINT, SIGTERM). Clients are served one
+    // request at a time in order of arrival. Returns false if the socket could
+    // not be created.
+    bool Serve(const string& socket_path);
+
+  private:
+    // Handles one request line, appends the response to response.
+    void HandleRequest(const string& request, string* response);
+
+    // Returns the decoded frame, 0 on error. The pointer is valid until the
+    // next call.
+    const SegmentationDesc* Frame(int frame);
+
+    // Returns the encoded image of frame at level and scale, 0 on error. The
+    // pointer is valid until the next call.
+    const vector<uchar>* RenderedImage(int frame, int level, int scale);
+
+    // Encodes the mask of region_ids at level and scale into encoded.
+    bool RenderMask(int frame,
+                    int level,
+                    int scale,
+                    const vector<int>& region_ids,
+                    vector<uchar>* encoded);
+
+  private:
+    string input_filename_;
+    RenderServerOptions options_;
+
+    SegmentationReader reader_;
+    SegmentationDesc hierarchy_;
+    RenderRect render_rect_;
+    int max_level_;
+
+    // Last decoded frame, continues delta decoding for sequential requests.
+    SegmentationReader::FrameBuffer frame_buffer_;
+
+    ImageWriter image_writer_;
+    BandRenderer renderer_;
+    vector<uchar> encoded_;
+
+    // Decoded frames by frame number, cost is 1 per frame.
+    LRUCache<int, SegmentationDesc> frame_cache_;
+
+    // Encoded images by (frame, (level, scale)), cost in bytes.
+    typedef std::pair<int, std::pair<int, int> > ImageKey;
+    LRUCache<ImageKey, vector<uchar> > image_cache_;
+
+    int frame_hits_;
+    int frame_misses_;
+    int image_hits_;
+    int image_misses_;
+    bool shutdown_;
+  };
+
+}  // namespace Segment.
+
+#endif  // RENDER_SERVER_H__
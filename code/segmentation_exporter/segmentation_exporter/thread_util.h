@@ -0,0 +1,168 @@
+/*
+ *  thread_util.h
+ *  segmentation_exporter
+ *
+ *  Minimal wrappers around pthreads and Win32 threads.
+ *
+ */
+
+#ifndef THREAD_UTIL_H__
+#define THREAD_UTIL_H__
+
+#ifdef _WIN32
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #include <windows.h>
+#else
+  #include <pthread.h>
+  #include <unistd.h>
+#endif
+
+namespace Segment {
+
+  class Mutex {
+  public:
+#ifdef _WIN32
+    Mutex() { InitializeCriticalSection(&mutex_); }
+    ~Mutex() { DeleteCriticalSection(&mutex_); }
+
+    void Lock() { EnterCriticalSection(&mutex_); }
+    void Unlock() { LeaveCriticalSection(&mutex_); }
+#else
+    Mutex() { pthread_mutex_init(&mutex_, 0); }
+    ~Mutex() { pthread_mutex_destroy(&mutex_); }
+
+    void Lock() { pthread_mutex_lock(&mutex_); }
+    void Unlock() { pthread_mutex_unlock(&mutex_); }
+#endif
+
+  private:
+    Mutex(const Mutex&);
+    Mutex& operator=(const Mutex&);
+
+#ifdef _WIN32
+    CRITICAL_SECTION mutex_;
+#else
+    pthread_mutex_t mutex_;
+#endif
+    friend class ConditionVariable;
+  };
+
+  // Locks mutex for the lifetime of the object.
+  class MutexLock {
+  public:
+    explicit MutexLock(Mutex* mutex) : mutex_(mutex) { mutex_->Lock(); }
+    ~MutexLock() { mutex_->Unlock(); }
+
+  private:
+    MutexLock(const MutexLock&);
+    MutexLock& operator=(const MutexLock&);
+
+    Mutex* mutex_;
+  };
+
+  class ConditionVariable {
+  public:
+#ifdef _WIN32
+    ConditionVariable() { InitializeConditionVariable(&cond_); }
+    ~ConditionVariable() {}
+
+    // Mutex has to be locked by the caller.
+    void Wait(Mutex* mutex) { SleepConditionVariableCS(&cond_, &mutex->mutex_, INFINITE); }
+    void Signal() { WakeConditionVariable(&cond_); }
+    void Broadcast() { WakeAllConditionVariable(&cond_); }
+#else
+    ConditionVariable() { pthread_cond_init(&cond_, 0); }
+    ~ConditionVariable() { pthread_cond_destroy(&cond_); }
+
+    // Mutex has to be locked by the caller.
+    void Wait(Mutex* mutex) { pthread_cond_wait(&cond_, &mutex->mutex_); }
+    void Signal() { pthread_cond_signal(&cond_); }
+    void Broadcast() { pthread_cond_broadcast(&cond_); }
+#endif
+
+  private:
+    ConditionVariable(const ConditionVariable&);
+    ConditionVariable& operator=(const ConditionVariable&);
+
+#ifdef _WIN32
+    CONDITION_VARIABLE cond_;
+#else
+    pthread_cond_t cond_;
+#endif
+  };
+
+  // Runs function(arg) on a new thread.
+  class Thread {
+  public:
+    typedef void (*Function)(void* arg);
+
+    Thread() : function_(0), arg_(0), started_(false) {}
+    ~Thread() { Join(); }
+
+    // Returns false if the thread could not be created.
+    bool Start(Function function, void* arg) {
+      function_ = function;
+      arg_ = arg;
+#ifdef _WIN32
+      thread_ = CreateThread(0, 0, &Thread::ThreadMain, this, 0, 0);
+      started_ = thread_ != 0;
+#else
+      started_ = pthread_create(&thread_, 0, &Thread::ThreadMain, this) == 0;
+#endif
+      return started_;
+    }
+
+    // Waits for the thread to finish, no-op if it was not started.
+    void Join() {
+      if (!started_)
+        return;
+#ifdef _WIN32
+      WaitForSingleObject(thread_, INFINITE);
+      CloseHandle(thread_);
+#else
+      pthread_join(thread_, 0);
+#endif
+      started_ = false;
+    }
+
+  private:
+    Thread(const Thread&);
+    Thread& operator=(const Thread&);
+
+#ifdef _WIN32
+    static DWORD WINAPI ThreadMain(LPVOID thread) {
+      reinterpret_cast<Thread*>(thread)->function_(reinterpret_cast<Thread*>(thread)->arg_);
+      return 0;
+    }
+
+    HANDLE thread_;
+#else
+    static void* ThreadMain(void* thread) {
+      reinterpret_cast<Thread*>(thread)->function_(reinterpret_cast<Thread*>(thread)->arg_);
+      return 0;
+    }
+
+    pthread_t thread_;
+#endif
+    Function function_;
+    void* arg_;
+    bool started_;
+  };
+
+  // Number of online processors, at least 1.
+  inline int NumProcessors() {
+#ifdef _WIN32
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    const long num_processors = system_info.dwNumberOfProcessors;
+#else
+    const long num_processors = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return num_processors > 0 ? num_processors : 1;
+  }
+
+}  // namespace Segment.
+
+#endif  // THREAD_UTIL_H__